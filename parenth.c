@@ -1,31 +1,1632 @@
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__AVX2__) || defined(__PCLMUL__)
+#include <immintrin.h>
+#endif
+
+const char* getMatchingBrace(const char* d)
+{
+    uint32_t num = 1;
+    char c;
+
+    while ('\0' != (c = *d)) {
+        if (c == '(') {
+            num++;
+        }
+        else if (c == ')') {
+            num--;
+            if (num == 0) {
+                break;
+            }
+        }
+        ++d;
+    }
+    return d;
+}
+
+/**
+ * getMatchingBrace of a slice, d follows a '('.
+ *
+ * @return offset of the matching ')' in d[0, len), len if there is none
+ */
+size_t getMatchingBraceLen(const char* d, size_t len)
+{
+    size_t num = 1;
+
+    for (size_t i = 0; i < len; i++) {
+        if (d[i] == '(') {
+            num++;
+        }
+        else if (d[i] == ')' && --num == 0) {
+            return i;
+        }
+    }
+    return len;
+}
+
+/*
+ * A '(' is kept when a later ')' brings the depth back to its level, a ')'
+ * when a kept '(' is open. Right to left, count the closers still free and
+ * drop the '(' finding none, compacting toward the end of the buffer. Left
+ * to right, drop the ')' at depth 0, compacting back to the start. Linear
+ * time, in place, returns the length kept.
+ */
+static inline size_t minRemoveCounter(char* ss, size_t n, char open, char close)
+{
+    char* s = ss + n;
+    const char* d = ss + n;
+    uint32_t num = 0;
+    char c;
+
+    while (d > ss) {   /* unmatched open */
+        c = *--d;
+        if (c == close) {
+            num++;
+        }
+        else if (c == open) {
+            if (num == 0) {
+                continue;
+            }
+            num--;
+        }
+        *--s = c;
+    }
+
+    d = s;
+    s = ss;
+    num = 0;
+    while (d < ss + n) {   /* unmatched close */
+        c = *d++;
+        if (c == open) {
+            num++;
+        }
+        else if (c == close) {
+            if (num == 0) {
+                continue;
+            }
+            num--;
+        }
+        *s++ = c;
+    }
+    return s - ss;
+}
+
+char* minRemoveToMakeValid(char* ss)
+{
+    ss[minRemoveCounter(ss, strlen(ss), '(', ')')] = '\0';
+    return ss;
+}
+
+/**
+ * minRemoveToMakeValid of a slice. The result is moved to the start of the
+ * slice, the bytes past it are left as they are and nothing is terminated.
+ *
+ * @return length of the result
+ */
+size_t minRemoveToMakeValidLen(char* s, size_t len)
+{
+    return minRemoveCounter(s, len, '(', ')');
+}
+
+/*
+ * Bracket pairs of minRemoveToMakeValidPairs, X(open, close). Define
+ * BRACKET_PAIRS before this point to change the set
+ */
+#ifndef BRACKET_PAIRS
+#define BRACKET_PAIRS(X) X('(', ')') X('{', '}') X('[', ']') X('<', '>')
+#endif
+#ifndef BRACKET_STACK_MAX
+#define BRACKET_STACK_MAX 1024      /* nesting depth of minRemoveToMakeValidPairs */
+#endif
+
+#define BRACKET_PAIR_INIT(o, c) { o, c },
+#define BRACKET_OPEN_CASE(o, c) case o:
+#define BRACKET_CLOSE_CASE(o, c) case c: return o;
+
+static const char bracketPairs[][2] = { BRACKET_PAIRS(BRACKET_PAIR_INIT) };
+
+static inline int bracketIsOpen(char c)
+{
+    switch (c) {
+    BRACKET_PAIRS(BRACKET_OPEN_CASE)
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* opening bracket of a closing one, 0 if c is not a closing bracket */
+static inline char bracketOpener(char c)
+{
+    switch (c) {
+    BRACKET_PAIRS(BRACKET_CLOSE_CASE)
+    default:
+        return 0;
+    }
+}
+
+/* squeeze the openers at the output offsets stack[0, top) out of [ss, s),
+   returns the new end */
+static char* bracketSqueeze(char* ss, const size_t* stack, size_t top, char* s)
+{
+    char* w;
+
+    if (top == 0) {
+        return s;
+    }
+    w = ss + stack[0];
+    for (size_t k = 0; k < top; k++) {
+        const char* from = ss + stack[k] + 1;
+        const char* to = (k + 1 < top) ? ss + stack[k + 1] : s;
+        memmove(w, from, to - from);
+        w += to - from;
+    }
+    return w;
+}
+
+/* one stack pass over ss. a closer not matching the innermost pending
+   opener is dropped, the openers still pending at the end are dropped.
+   without write, only report whether the stack overflows */
+static int bracketScan(char* ss, int write)
+{
+    size_t stack[BRACKET_STACK_MAX];
+    size_t top = 0;
+    char* s = ss;
+    const char* d = ss;
+    char c, o;
+
+    while ('\0' != (c = *d++)) {
+        if (bracketIsOpen(c)) {
+            if (top == BRACKET_STACK_MAX) {
+                return EOVERFLOW;
+            }
+            stack[top++] = write ? (size_t)(s - ss) : (size_t)(d - 1 - ss);
+        }
+        else if (0 != (o = bracketOpener(c))) {
+            if (top == 0 || ss[stack[top - 1]] != o) {
+                continue;
+            }
+            top--;
+        }
+        if (write) {
+            *s = c;
+        }
+        s++;
+    }
+    if (!write) {
+        return 0;
+    }
+
+    *bracketSqueeze(ss, stack, top, s) = '\0';   /* openers never closed */
+    return 0;
+}
+
+/**
+ * minRemoveToMakeValid for the BRACKET_PAIRS set, in place. A closing
+ * bracket is kept when it closes the innermost pending opening bracket,
+ * an opening bracket when it gets closed. A single pair set takes the
+ * counter path of minRemoveToMakeValid.
+ *
+ * @return 0 on success, EOVERFLOW if the nesting is deeper than
+ *         BRACKET_STACK_MAX, ss is unchanged then
+ */
+int minRemoveToMakeValidPairs(char* ss)
+{
+    size_t open = 0;
+
+    if (sizeof(bracketPairs) / sizeof(bracketPairs[0]) == 1) {
+        ss[minRemoveCounter(ss, strlen(ss), bracketPairs[0][0], bracketPairs[0][1])] = '\0';
+        return 0;
+    }
+
+    for (const char* d = ss; *d; d++) {
+        open += bracketIsOpen(*d);
+    }
+    if (open > BRACKET_STACK_MAX && EOVERFLOW == bracketScan(ss, 0)) {
+        return EOVERFLOW;
+    }
+    return bracketScan(ss, 1);
+}
+
+/* byte at a time balance check of [i, len) entered at depth num. last is
+   the last offset with depth 0, or -1 */
+static int isBalancedScalar(const char* s, size_t i, size_t len, size_t num, ptrdiff_t last, size_t* err_pos)
+{
+    for (; i < len; i++) {
+        if (s[i] == '(') {
+            num++;
+        }
+        else if (s[i] == ')') {
+            if (num == 0) {
+                *err_pos = i;
+                return 0;
+            }
+            if (--num == 0) {
+                last = i;
+            }
+        }
+    }
+    if (num != 0) {   /* the first '(' after the last return to depth 0 is never closed */
+        *err_pos = (const char*)memchr(s + last + 1, '(', len - (last + 1)) - s;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * Check that the parentheses of s[0, len) are balanced. With AVX2 the
+ * input is processed in 32 byte blocks : '(' and ')' are compared into
+ * +1/-1 byte deltas, an in-register prefix sum gives the depth at each
+ * byte, and the block is checked against the depth it is entered at with
+ * one compare and movemask.
+ *
+ * @param err_pos : first offending position when unbalanced, the ')'
+ *                  closing nothing or the first '(' never closed
+ *
+ * @return 1 if balanced, 0 otherwise
+ */
+int isBalanced(const char* s, size_t len, size_t* err_pos)
+{
+    size_t i = 0, num = 0;
+    ptrdiff_t last = -1;
+
+#ifdef __AVX2__
+    const __m256i open = _mm256_set1_epi8('(');
+    const __m256i close = _mm256_set1_epi8(')');
+    const __m256i byte15 = _mm256_set1_epi8(15);
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+        __m256i x = _mm256_sub_epi8(_mm256_cmpeq_epi8(v, close), _mm256_cmpeq_epi8(v, open));
+
+        /* prefix sum in each 128 bit lane, then carry the low lane total */
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 1));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 2));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 4));
+        x = _mm256_add_epi8(x, _mm256_slli_si256(x, 8));
+        x = _mm256_add_epi8(x, _mm256_permute2x128_si256(_mm256_shuffle_epi8(x, byte15), x, 0x08));
+
+        if (num <= 32) {   /* deeper blocks can neither fail nor return to 0 */
+            __m256i d = _mm256_set1_epi8(-(int8_t)num);
+            uint32_t neg = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(d, x));
+            uint32_t zero = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(d, x));
+
+            if (neg) {
+                *err_pos = i + __builtin_ctz(neg);
+                return 0;
+            }
+            if (zero) {
+                last = i + 31 - __builtin_clz(zero);
+            }
+        }
+        num += (int8_t)_mm256_extract_epi8(x, 31);
+    }
+#endif
+
+    return isBalancedScalar(s, i, len, num, last, err_pos);
+}
+
+/* Lexical syntax of the text around the brackets */
+struct parenth_syntax {
+    const char* quotes;         /* quote characters, "" for none */
+    char escape;                /* makes the next character literal in code and quotes, 0 for none */
+    const char* line_comment;   /* comment up to the end of the line, NULL for none */
+    const char* block_open;     /* block comment markers, NULL for none */
+    const char* block_close;
+};
+
+enum { SYNTAX_CODE, SYNTAX_QUOTE, SYNTAX_LINE, SYNTAX_BLOCK };
+
+struct syntax_scan {
+    const struct parenth_syntax* syn;
+    size_t line_len, open_len, close_len;
+    int state;
+    char quote;                 /* closing quote in SYNTAX_QUOTE */
+    uint8_t special[256];       /* characters that may leave SYNTAX_CODE */
+};
+
+static void syntaxInit(struct syntax_scan* st, const struct parenth_syntax* syn)
+{
+    st->syn = syn;
+    st->line_len = syn->line_comment ? strlen(syn->line_comment) : 0;
+    st->open_len = syn->block_open ? strlen(syn->block_open) : 0;
+    st->close_len = syn->block_close ? strlen(syn->block_close) : 0;
+    st->state = SYNTAX_CODE;
+    st->quote = 0;
+    memset(st->special, 0, sizeof(st->special));
+    for (const char* q = syn->quotes; *q; q++) {
+        st->special[(unsigned char)*q] = 1;
+    }
+    st->special[(unsigned char)syn->escape] = (syn->escape != 0);
+    if (st->line_len) {
+        st->special[(unsigned char)syn->line_comment[0]] = 1;
+    }
+    if (st->open_len) {
+        st->special[(unsigned char)syn->block_open[0]] = 1;
+    }
+}
+
+static inline int syntaxAt(const char* s, size_t i, size_t len, const char* m, size_t n)
+{
+    return n && n <= len - i && 0 == memcmp(s + i, m, n);
+}
+
+/* advance over the character or marker at s[i]. *code is the character
+   when it is code, 0 otherwise */
+static inline size_t syntaxStep(struct syntax_scan* st, const char* s, size_t i, size_t len, char* code)
+{
+    const struct parenth_syntax* syn = st->syn;
+    char c = s[i];
+
+    if (st->state == SYNTAX_CODE && !st->special[(unsigned char)c]) {
+        *code = c;
+        return i + 1;
+    }
+    *code = 0;
+    if (c == syn->escape && c && st->state <= SYNTAX_QUOTE) {
+        return (i + 2 < len) ? i + 2 : len;
+    }
+    switch (st->state) {
+    case SYNTAX_CODE:
+        if (c && strchr(syn->quotes, c)) {
+            st->state = SYNTAX_QUOTE;
+            st->quote = c;
+        }
+        else if (syntaxAt(s, i, len, syn->line_comment, st->line_len)) {
+            st->state = SYNTAX_LINE;
+            return i + st->line_len;
+        }
+        else if (syntaxAt(s, i, len, syn->block_open, st->open_len)) {
+            st->state = SYNTAX_BLOCK;
+            return i + st->open_len;
+        }
+        else {
+            *code = c;
+        }
+        break;
+    case SYNTAX_QUOTE:
+        if (c == st->quote) {
+            st->state = SYNTAX_CODE;
+        }
+        break;
+    case SYNTAX_LINE:
+        if (c == '\n') {
+            st->state = SYNTAX_CODE;
+        }
+        break;
+    default:
+        if (syntaxAt(s, i, len, syn->block_close, st->close_len)) {
+            st->state = SYNTAX_CODE;
+            return i + st->close_len;
+        }
+    }
+    return i + 1;
+}
+
+/* positions of c in the 64 bytes at s */
+static inline uint64_t syntaxMask(const char* s, char c)
+{
+#ifdef __AVX2__
+    __m256i v = _mm256_set1_epi8(c);
+    uint64_t lo = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)s), v));
+    uint64_t hi = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + 32)), v));
+    return lo | hi << 32;
+#else
+    uint64_t m = 0;
+    for (int k = 0; k < 64; k++) {
+        m |= (uint64_t)(s[k] == c) << k;
+    }
+    return m;
+#endif
+}
+
+/* characters escaped by an odd run of escapes, *carry is set when the
+   first character of the next block is escaped */
+static inline uint64_t syntaxEscaped(uint64_t escape, uint64_t* carry)
+{
+    const uint64_t even = 0x5555555555555555ULL;
+    uint64_t escaped = *carry;
+    uint64_t starts, seq, follows;
+
+    escape &= ~escaped;
+    follows = escape << 1 | escaped;
+    starts = escape & ~even & ~follows;
+    *carry = __builtin_add_overflow(starts, escape, &seq);
+    return (even ^ (seq << 1)) & follows;
+}
+
+/* bits at and after each set bit of q up to the next one */
+static inline uint64_t syntaxPrefixXor(uint64_t q)
+{
+#if defined(__PCLMUL__)
+    return (uint64_t)_mm_cvtsi128_si64(_mm_clmulepi64_si128(_mm_set_epi64x(0, q), _mm_set1_epi8((char)0xFF), 0));
+#else
+    q ^= q << 1;
+    q ^= q << 2;
+    q ^= q << 4;
+    q ^= q << 8;
+    q ^= q << 16;
+    q ^= q << 32;
+    return q;
+#endif
+}
+
+/* depth update over the code brackets of a 64 byte block */
+static inline int syntaxDepth(uint64_t open, uint64_t close, size_t base, size_t* num, ptrdiff_t* last, size_t* err_pos)
+{
+    uint64_t m = open | close;
+
+    if (*num > (size_t)__builtin_popcountll(close)) {   /* cannot get back to 0 */
+        *num += __builtin_popcountll(open);
+        *num -= __builtin_popcountll(close);
+        return 1;
+    }
+    for (; m; m &= m - 1) {
+        int b = __builtin_ctzll(m);
+        if (open >> b & 1) {
+            (*num)++;
+        }
+        else if (*num == 0) {
+            *err_pos = base + b;
+            return 0;
+        }
+        else if (--*num == 0) {
+            *last = base + b;
+        }
+    }
+    return 1;
+}
+
+static int syntaxCheck(const char* s, size_t len, const struct parenth_syntax* syn, size_t* err_pos, int vector)
+{
+    struct syntax_scan st;
+    size_t i = 0, num = 0;
+    ptrdiff_t last = -1;
+    char code;
+
+    syntaxInit(&st, syn);
+    if (vector && strlen(syn->quotes) <= 1 && !st.line_len && !st.open_len) {
+        /* quote regions as a prefix xor of the unescaped quotes */
+        uint64_t inq = 0, esc = 0;
+
+        for (; i + 64 <= len; i += 64) {
+            uint64_t escaped = syn->escape ? syntaxEscaped(syntaxMask(s + i, syn->escape), &esc) : 0;
+            uint64_t q = syn->quotes[0] ? syntaxMask(s + i, syn->quotes[0]) & ~escaped : 0;
+            uint64_t in = syntaxPrefixXor(q) ^ inq;
+            uint64_t code_mask = ~in & ~escaped;
+
+            inq = (uint64_t)((int64_t)in >> 63);
+            if (!syntaxDepth(syntaxMask(s + i, '(') & code_mask, syntaxMask(s + i, ')') & code_mask,
+                    i, &num, &last, err_pos)) {
+                return 0;
+            }
+        }
+        st.state = inq ? SYNTAX_QUOTE : SYNTAX_CODE;
+        st.quote = syn->quotes[0];
+        if (esc && i < len) {
+            i++;
+        }
+    }
+    else if (vector) {
+        /* jump between the characters that matter in the current state,
+           the brackets before them are taken from the block masks */
+        while (i + 64 <= len) {
+            uint64_t m;
+            size_t at;
+
+            if (st.state == SYNTAX_CODE) {
+                m = syn->escape ? syntaxMask(s + i, syn->escape) : 0;
+                for (const char* q = syn->quotes; *q; q++) {
+                    m |= syntaxMask(s + i, *q);
+                }
+                m |= st.line_len ? syntaxMask(s + i, syn->line_comment[0]) : 0;
+                m |= st.open_len ? syntaxMask(s + i, syn->block_open[0]) : 0;
+                if (!(m & 1)) {   /* some code before the next special character */
+                    uint64_t keep = m ? (m & -m) - 1 : ~(uint64_t)0;
+                    if (!syntaxDepth(syntaxMask(s + i, '(') & keep, syntaxMask(s + i, ')') & keep,
+                            i, &num, &last, err_pos)) {
+                        return 0;
+                    }
+                }
+            }
+            else {
+                m = (st.state == SYNTAX_QUOTE) ? syntaxMask(s + i, st.quote) | (syn->escape ? syntaxMask(s + i, syn->escape) : 0)
+                  : (st.state == SYNTAX_LINE) ? syntaxMask(s + i, '\n')
+                  : syntaxMask(s + i, syn->block_close[0]);
+            }
+            if (m == 0) {
+                i += 64;
+                continue;
+            }
+
+            at = i + __builtin_ctzll(m);
+            i = syntaxStep(&st, s, at, len, &code);
+            if (code == '(') {
+                num++;
+            }
+            else if (code == ')') {
+                if (num == 0) {
+                    *err_pos = at;
+                    return 0;
+                }
+                if (--num == 0) {
+                    last = at;
+                }
+            }
+        }
+    }
+
+    while (i < len) {
+        size_t at = i;
+        i = syntaxStep(&st, s, i, len, &code);
+        if (code == '(') {
+            num++;
+        }
+        else if (code == ')') {
+            if (num == 0) {
+                *err_pos = at;
+                return 0;
+            }
+            if (--num == 0) {
+                last = at;
+            }
+        }
+    }
+
+    if (num != 0) {   /* the first code '(' after the last return to depth 0 is never closed */
+        syntaxInit(&st, syn);
+        for (i = last + 1; i < len; ) {
+            size_t at = i;
+            i = syntaxStep(&st, s, i, len, &code);
+            if (code == '(') {
+                *err_pos = at;
+                break;
+            }
+        }
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * isBalanced ignoring the parentheses in quotes and comments. Blocks of
+ * 64 bytes are classified into bitmasks. With a single quote character
+ * and no comments the quoted regions are a carry-less multiply (prefix
+ * xor) of the unescaped quote mask, otherwise the state machine only
+ * runs on the blocks holding a character that can change the state.
+ *
+ * @param syn : quotes, escape character and comment markers
+ * @param err_pos : first offending position when unbalanced
+ *
+ * @return 1 if balanced, 0 otherwise
+ */
+int isBalancedSyntax(const char* s, size_t len, const struct parenth_syntax* syn, size_t* err_pos)
+{
+    return syntaxCheck(s, len, syn, err_pos, 1);
+}
+
+/* stack repair pass of minRemoveToMakeValidSyntax, see bracketScan */
+static int syntaxRepair(char* ss, size_t len, const struct parenth_syntax* syn, int write)
+{
+    size_t stack[BRACKET_STACK_MAX];
+    size_t top = 0, i = 0, o = 0;
+    struct syntax_scan st;
+    char code;
+
+    syntaxInit(&st, syn);
+    while (i < len) {
+        size_t next = syntaxStep(&st, ss, i, len, &code);
+
+        if (code == '(') {
+            if (top == BRACKET_STACK_MAX) {
+                return EOVERFLOW;
+            }
+            stack[top++] = o;
+        }
+        else if (code == ')') {
+            if (top == 0) {
+                i = next;
+                continue;
+            }
+            top--;
+        }
+        if (write && o != i) {
+            memmove(ss + o, ss + i, next - i);
+        }
+        o += next - i;
+        i = next;
+    }
+    if (write) {
+        *bracketSqueeze(ss, stack, top, ss + o) = '\0';
+    }
+    return 0;
+}
+
+/**
+ * minRemoveToMakeValid leaving the parentheses in quotes and comments
+ * alone. Balanced input, the common case, is only checked.
+ *
+ * @return 0 on success, EOVERFLOW if more than BRACKET_STACK_MAX
+ *         parentheses are open at once, ss is unchanged then
+ */
+int minRemoveToMakeValidSyntax(char* ss, const struct parenth_syntax* syn)
+{
+    size_t len = strlen(ss), err_pos, open = 0;
+
+    if (isBalancedSyntax(ss, len, syn, &err_pos)) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        open += (ss[i] == '(');
+    }
+    if (open > BRACKET_STACK_MAX && EOVERFLOW == syntaxRepair(ss, len, syn, 0)) {
+        return EOVERFLOW;
+    }
+    return syntaxRepair(ss, len, syn, 1);
+}
+
+#define PARENTH_MAX_THREADS 64
+
+/* per chunk balance summary */
+struct parenth_chunk {
+    const char* s;
+    size_t begin, end;
+    size_t close;       /* ')' closing nothing inside the chunk */
+    size_t open;        /* '(' closed nothing inside the chunk */
+    size_t z;           /* one past the last such ')', begin if none */
+    size_t depth;       /* '(' pending from the chunks on the left */
+    size_t free;        /* ')' free from the chunks on the right */
+    char* dst;          /* output of the chunk */
+    size_t n;           /* bytes kept */
+};
+
+static void* parenthSummarize(void* arg)
+{
+    struct parenth_chunk* c = arg;
+    size_t num = 0;
+
+    c->close = 0;
+    c->z = c->begin;
+    for (size_t i = c->begin; i < c->end; i++) {
+        if (c->s[i] == '(') {
+            num++;
+        }
+        else if (c->s[i] == ')') {
+            if (num == 0) {
+                c->close++;
+                c->z = i + 1;
+            }
+            else {
+                num--;
+            }
+        }
+    }
+    c->open = num;
+    return NULL;
+}
+
+/* every '(' before z is closed inside the chunk and every ')' after z is,
+   so [begin, z) only has ')' to decide, left to right from the pending
+   depth, and [z, end) only has '(' to decide, right to left from the free
+   closers, writing back from the end of the chunk output */
+static void* parenthCompact(void* arg)
+{
+    struct parenth_chunk* c = arg;
+    char* s = c->dst;
+    char* e = c->dst + c->n;
+    size_t num = c->depth;
+
+    for (size_t i = c->begin; i < c->z; i++) {
+        char ch = c->s[i];
+        if (ch == '(') {
+            num++;
+        }
+        else if (ch == ')') {
+            if (num == 0) {
+                continue;
+            }
+            num--;
+        }
+        *s++ = ch;
+    }
+
+    num = c->free;
+    for (size_t i = c->end; i > c->z; ) {
+        char ch = c->s[--i];
+        if (ch == ')') {
+            num++;
+        }
+        else if (ch == '(') {
+            if (num == 0) {
+                continue;
+            }
+            num--;
+        }
+        *--e = ch;
+    }
+    return NULL;
+}
+
+/* run fn on every chunk, chunk 0 on the calling thread. a chunk whose
+   thread cannot be created runs on the calling thread as well */
+static void parenthRun(void* (*fn)(void*), struct parenth_chunk* c, unsigned n)
+{
+    pthread_t tid[PARENTH_MAX_THREADS];
+    int created[PARENTH_MAX_THREADS];
+
+    for (unsigned i = 1; i < n; i++) {
+        created[i] = (0 == pthread_create(&tid[i], NULL, fn, &c[i]));
+        if (!created[i]) {
+            fn(&c[i]);
+        }
+    }
+    fn(&c[0]);
+    for (unsigned i = 1; i < n; i++) {
+        if (created[i]) {
+            pthread_join(tid[i], NULL);
+        }
+    }
+}
+
+/**
+ * minRemoveToMakeValid of s[0, len) into dst on nthreads threads. Each
+ * chunk is reduced to its unmatched ')' and '(' counts, the summaries are
+ * combined to know how many '(' are pending on the left and how many ')'
+ * are free on the right of every chunk, and the chunks are compacted in
+ * parallel to their exact output offset.
+ *
+ * @param dst : len + 1 bytes, must not overlap s
+ *
+ * @return length of the nul terminated output
+ */
+size_t minRemoveToMakeValidParallel(const char* s, size_t len, char* dst, unsigned nthreads)
+{
+    struct parenth_chunk c[PARENTH_MAX_THREADS];
+    size_t depth = 0, spare = 0, off = 0;
+    unsigned n = nthreads < 1 ? 1 : nthreads > PARENTH_MAX_THREADS ? PARENTH_MAX_THREADS : nthreads;
+
+    for (unsigned i = 0; i < n; i++) {
+        c[i].s = s;
+        c[i].begin = len / n * i;
+        c[i].end = (i + 1 == n) ? len : len / n * (i + 1);
+    }
+    parenthRun(parenthSummarize, c, n);
+
+    for (unsigned i = 0; i < n; i++) {   /* '(' pending on the left */
+        c[i].depth = depth;
+        depth = (depth > c[i].close ? depth - c[i].close : 0) + c[i].open;
+    }
+    for (unsigned i = n; i-- > 0; ) {    /* ')' free on the right */
+        c[i].free = spare;
+        spare = (spare > c[i].open ? spare - c[i].open : 0) + c[i].close;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        size_t drop_close = c[i].close > c[i].depth ? c[i].close - c[i].depth : 0;
+        size_t drop_open = c[i].open > c[i].free ? c[i].open - c[i].free : 0;
+
+        c[i].dst = dst + off;
+        c[i].n = c[i].end - c[i].begin - drop_close - drop_open;
+        off += c[i].n;
+    }
+    parenthRun(parenthCompact, c, n);
+
+    dst[off] = '\0';
+    return off;
+}
+
+#define PARENTH_NOMATCH ((size_t)-1)
+#define PARENTH_NONE UINT32_MAX
+
+/*
+ * Bracket pair index. A bitmap with per word ranks maps an offset to the
+ * ordinal of the brackets before it, the per bracket arrays hold the pair
+ * structure
+ */
+struct parenth_index {
+    const char* s;
+    size_t len;
+    size_t n;               /* brackets */
+    uint64_t* bits;         /* bracket offsets */
+    uint32_t* rank;         /* brackets before each bitmap word */
+    uint32_t* pos;          /* offset of each bracket */
+    uint32_t* partner;      /* matching bracket, PARENTH_NONE if unmatched */
+    uint32_t* parent;       /* innermost enclosing '(', PARENTH_NONE at top level */
+    uint32_t* depth;        /* '(' enclosing the bracket */
+};
+
+/**
+ * Build the pair index of s[0, len) in one pass over the text. Pairs are
+ * matched like minRemoveToMakeValid does, a '(' never closed encloses the
+ * rest of the text.
+ *
+ * @return 0 on success, ENOMEM, or EOVERFLOW if len does not fit 32 bits
+ */
+int parenthIndexBuild(struct parenth_index* idx, const char* s, size_t len)
+{
+    size_t words = len / 64 + 1, n = 0;
+    uint32_t top = PARENTH_NONE, d = 0;
+    uint64_t* bits;
+
+    if (len >= UINT32_MAX) {
+        return EOVERFLOW;
+    }
+    bits = calloc(words, sizeof(uint64_t) + sizeof(uint32_t));
+    if (bits == NULL) {
+        return ENOMEM;
+    }
+    idx->s = s;
+    idx->len = len;
+    idx->bits = bits;
+    idx->rank = (uint32_t*)(bits + words);
+
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '(' || s[i] == ')') {
+            bits[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+    }
+    for (size_t w = 0; w < words; w++) {
+        idx->rank[w] = (uint32_t)n;
+        n += __builtin_popcountll(bits[w]);
+    }
+
+    idx->n = n;
+    idx->pos = malloc(n * 4 * sizeof(uint32_t) + 1);
+    if (idx->pos == NULL) {
+        free(bits);
+        return ENOMEM;
+    }
+    idx->partner = idx->pos + n;
+    idx->parent = idx->partner + n;
+    idx->depth = idx->parent + n;
+
+    n = 0;
+    for (size_t w = 0; w < words; w++) {
+        for (uint64_t m = bits[w]; m; m &= m - 1) {
+            uint32_t off = (uint32_t)(w * 64 + __builtin_ctzll(m));
+
+            idx->pos[n] = off;
+            idx->partner[n] = PARENTH_NONE;
+            if (s[off] == '(') {
+                idx->parent[n] = top;
+                idx->depth[n] = d++;
+                top = (uint32_t)n;
+            }
+            else if (top == PARENTH_NONE) {   /* closes nothing */
+                idx->parent[n] = PARENTH_NONE;
+                idx->depth[n] = 0;
+            }
+            else {
+                idx->partner[n] = top;
+                idx->partner[top] = (uint32_t)n;
+                idx->parent[n] = idx->parent[top];
+                idx->depth[n] = --d;
+                top = idx->parent[top];
+            }
+            n++;
+        }
+    }
+    return 0;
+}
+
+void parenthIndexFree(struct parenth_index* idx)
+{
+    free(idx->bits);
+    free(idx->pos);
+}
+
+/* brackets before off */
+static inline size_t parenthIndexRank(const struct parenth_index* idx, size_t off)
+{
+    return idx->rank[off / 64] + __builtin_popcountll(idx->bits[off / 64] & (((uint64_t)1 << (off % 64)) - 1));
+}
+
+static inline int parenthIndexIsBracket(const struct parenth_index* idx, size_t off)
+{
+    return off < idx->len && (idx->bits[off / 64] >> (off % 64) & 1);
+}
+
+/**
+ * @return offset of the bracket matching the one at off, PARENTH_NOMATCH
+ *         if off is not a bracket or it is unmatched
+ */
+size_t parenthIndexMatch(const struct parenth_index* idx, size_t off)
+{
+    uint32_t k;
+
+    if (!parenthIndexIsBracket(idx, off)) {
+        return PARENTH_NOMATCH;
+    }
+    k = idx->partner[parenthIndexRank(idx, off)];
+    return k == PARENTH_NONE ? PARENTH_NOMATCH : idx->pos[k];
+}
+
+/**
+ * @return offset of the innermost '(' enclosing off, the pair of off when
+ *         it is a bracket, PARENTH_NOMATCH at top level
+ */
+size_t parenthIndexEnclosing(const struct parenth_index* idx, size_t off)
+{
+    size_t r = parenthIndexRank(idx, off < idx->len ? off : idx->len);
+    uint32_t k;
+
+    if (parenthIndexIsBracket(idx, off)) {
+        k = idx->parent[r];
+    }
+    else if (r == 0) {
+        return PARENTH_NOMATCH;
+    }
+    else {   /* from the last bracket before off */
+        k = (idx->s[idx->pos[r - 1]] == '(') ? (uint32_t)(r - 1) : idx->parent[r - 1];
+    }
+    return k == PARENTH_NONE ? PARENTH_NOMATCH : idx->pos[k];
+}
+
+/**
+ * @return number of '(' enclosing off
+ */
+size_t parenthIndexDepth(const struct parenth_index* idx, size_t off)
+{
+    size_t r = parenthIndexRank(idx, off < idx->len ? off : idx->len);
+
+    if (parenthIndexIsBracket(idx, off)) {
+        return idx->depth[r];
+    }
+    if (r == 0) {
+        return 0;
+    }
+    return idx->depth[r - 1] + (idx->s[idx->pos[r - 1]] == '(');
+}
+
+#define PARENTH_ROPE_BLOCK 512
+
+/*
+ * Editable document as a treap of text blocks ordered by position. Each
+ * node keeps the balance summary of its block and of its subtree, the same
+ * (close, open) pair the parallel repair computes per chunk, so an edit
+ * only recomputes the blocks it touches and the summaries on their paths.
+ */
+struct parenth_rope_node {
+    struct parenth_rope_node *left, *right;
+    uint32_t prio;
+    uint32_t n;                     /* bytes in text */
+    uint32_t close, open;           /* block summary */
+    size_t len;                     /* subtree bytes */
+    size_t sclose, sopen;           /* subtree summary */
+    char text[PARENTH_ROPE_BLOCK];
+};
+
+struct parenth_rope {
+    struct parenth_rope_node* root;
+    struct parenth_rope_node* spare;    /* free nodes, linked through right */
+    uint32_t seed;
+};
+
+/* summary of a followed by b */
+static inline void parenthJoin(size_t* close, size_t* open, size_t c2, size_t o2)
+{
+    size_t m = (*open < c2) ? *open : c2;
+
+    *close += c2 - m;
+    *open = *open + o2 - m;
+}
+
+static void ropeUpdate(struct parenth_rope_node* t)
+{
+    t->len = t->n;
+    t->sclose = t->close;
+    t->sopen = t->open;
+    if (t->left) {
+        t->len += t->left->len;
+        t->sclose = t->left->sclose;
+        t->sopen = t->left->sopen;
+        parenthJoin(&t->sclose, &t->sopen, t->close, t->open);
+    }
+    if (t->right) {
+        t->len += t->right->len;
+        parenthJoin(&t->sclose, &t->sopen, t->right->sclose, t->right->sopen);
+    }
+}
+
+static void ropeBlock(struct parenth_rope_node* t)
+{
+    uint32_t close = 0, open = 0;
+
+    for (uint32_t i = 0; i < t->n; i++) {
+        if (t->text[i] == '(') {
+            open++;
+        }
+        else if (t->text[i] == ')') {
+            if (open) {
+                open--;
+            }
+            else {
+                close++;
+            }
+        }
+    }
+    t->close = close;
+    t->open = open;
+    ropeUpdate(t);
+}
+
+/* nodes are taken from the spare list, filled by ropeReserve beforehand */
+static struct parenth_rope_node* ropeNode(struct parenth_rope* r, const char* s, size_t n)
+{
+    struct parenth_rope_node* t = r->spare;
+
+    r->spare = t->right;
+    r->seed ^= r->seed << 13;
+    r->seed ^= r->seed >> 17;
+    r->seed ^= r->seed << 5;
+    t->left = t->right = NULL;
+    t->prio = r->seed;
+    t->n = (uint32_t)n;
+    memcpy(t->text, s, n);
+    ropeBlock(t);
+    return t;
+}
+
+static void ropeRelease(struct parenth_rope* r, struct parenth_rope_node* t)
+{
+    if (t) {
+        ropeRelease(r, t->left);
+        ropeRelease(r, t->right);
+        t->right = r->spare;
+        r->spare = t;
+    }
+}
+
+static int ropeReserve(struct parenth_rope* r, size_t count)
+{
+    struct parenth_rope_node* t = r->spare;
+
+    for (; t && count; t = t->right) {
+        count--;
+    }
+    while (count--) {
+        if (NULL == (t = malloc(sizeof(*t)))) {
+            return ENOMEM;
+        }
+        t->right = r->spare;
+        r->spare = t;
+    }
+    return 0;
+}
+
+static struct parenth_rope_node* ropeMerge(struct parenth_rope_node* a, struct parenth_rope_node* b)
+{
+    if (!a || !b) {
+        return a ? a : b;
+    }
+    if (a->prio > b->prio) {
+        a->right = ropeMerge(a->right, b);
+        ropeUpdate(a);
+        return a;
+    }
+    b->left = ropeMerge(a, b->left);
+    ropeUpdate(b);
+    return b;
+}
+
+/* first pos bytes to *a, the rest to *b. a block straddling pos is cut,
+   its tail taking one spare node */
+static void ropeSplit(struct parenth_rope* r, struct parenth_rope_node* t, size_t pos,
+                      struct parenth_rope_node** a, struct parenth_rope_node** b)
+{
+    size_t left;
+
+    if (!t) {
+        *a = *b = NULL;
+        return;
+    }
+    left = t->left ? t->left->len : 0;
+    if (pos <= left) {
+        ropeSplit(r, t->left, pos, a, &t->left);
+        ropeUpdate(t);
+        *b = t;
+    }
+    else if (pos >= left + t->n) {
+        ropeSplit(r, t->right, pos - left - t->n, &t->right, b);
+        ropeUpdate(t);
+        *a = t;
+    }
+    else {
+        struct parenth_rope_node* tail = ropeNode(r, t->text + (pos - left), left + t->n - pos);
+
+        t->n = (uint32_t)(pos - left);
+        ropeBlock(t);
+        *b = ropeMerge(tail, t->right);
+        t->right = NULL;
+        ropeUpdate(t);
+        *a = t;
+    }
+}
+
+/* detach the first block of *t */
+static struct parenth_rope_node* ropeTakeFirst(struct parenth_rope_node** t)
+{
+    struct parenth_rope_node* first;
+
+    if (!*t) {
+        return NULL;
+    }
+    if (!(*t)->left) {
+        first = *t;
+        *t = first->right;
+        first->right = NULL;
+        return first;
+    }
+    first = ropeTakeFirst(&(*t)->left);
+    ropeUpdate(*t);
+    return first;
+}
+
+/* append s[0, n) to t, topping up its last block first */
+static struct parenth_rope_node* ropeAppend(struct parenth_rope* r, struct parenth_rope_node* t, const char* s, size_t n)
+{
+    struct parenth_rope_node* last = t;
+
+    while (last && last->right) {
+        last = last->right;
+    }
+    if (last && last->n < PARENTH_ROPE_BLOCK && n) {
+        size_t k = PARENTH_ROPE_BLOCK - last->n;
+        struct parenth_rope_node* a;
+        struct parenth_rope_node* b;
+
+        k = (k < n) ? k : n;
+        ropeSplit(r, t, t->len - last->n, &a, &b);    /* b is last */
+        memcpy(last->text + last->n, s, k);
+        last->n += (uint32_t)k;
+        ropeBlock(last);
+        t = ropeMerge(a, last);
+        s += k;
+        n -= k;
+    }
+    while (n) {
+        size_t k = (n < PARENTH_ROPE_BLOCK) ? n : PARENTH_ROPE_BLOCK;
+
+        t = ropeMerge(t, ropeNode(r, s, k));
+        s += k;
+        n -= k;
+    }
+    return t;
+}
+
+/**
+ * Replace removed bytes at pos by inserted[0, n). Only the blocks around
+ * pos are rescanned, the other summaries are combined in O(log size).
+ *
+ * @return 0 on success, EINVAL if the range is outside the document,
+ *         ENOMEM with the document unchanged
+ */
+int parenthRopeEdit(struct parenth_rope* r, size_t pos, size_t removed, const char* inserted, size_t n)
+{
+    struct parenth_rope_node *a, *b, *c, *first;
+    size_t len = r->root ? r->root->len : 0;
+
+    if (pos > len || removed > len - pos) {
+        return EINVAL;
+    }
+    if (ropeReserve(r, n / PARENTH_ROPE_BLOCK + 4)) {
+        return ENOMEM;
+    }
+    ropeSplit(r, r->root, pos, &a, &b);
+    ropeSplit(r, b, removed, &b, &c);
+    ropeRelease(r, b);
+    a = ropeAppend(r, a, inserted, n);
+    if (NULL != (first = ropeTakeFirst(&c))) {   /* merge the blocks at the seam */
+        a = ropeAppend(r, a, first->text, first->n);
+        first->right = r->spare;
+        r->spare = first;
+    }
+    r->root = ropeMerge(a, c);
+    return 0;
+}
+
+/**
+ * @return 0 on success, ENOMEM
+ */
+int parenthRopeInit(struct parenth_rope* r, const char* s, size_t len)
+{
+    r->root = r->spare = NULL;
+    r->seed = 2463534242u;
+    return parenthRopeEdit(r, 0, 0, s, len);
+}
+
+void parenthRopeFree(struct parenth_rope* r)
+{
+    struct parenth_rope_node* t;
+
+    ropeRelease(r, r->root);
+    while (NULL != (t = r->spare)) {
+        r->spare = t->right;
+        free(t);
+    }
+    r->root = NULL;
+}
 
-static const char* getMatchingBrace(const char* d)
+size_t parenthRopeLength(const struct parenth_rope* r)
 {
-    uint32_t num = 1;
-    char c;
+    return r->root ? r->root->len : 0;
+}
 
-    while ('\0' != (c = *d)) {
-        if (c == '(') {
-            num++;
+static size_t ropeCopy(const struct parenth_rope_node* t, char* dst)
+{
+    size_t n = 0;
+
+    if (t) {
+        n = ropeCopy(t->left, dst);
+        memcpy(dst + n, t->text, t->n);
+        n += t->n;
+        n += ropeCopy(t->right, dst + n);
+    }
+    return n;
+}
+
+/* copy the document to dst, returns its length */
+size_t parenthRopeCopy(const struct parenth_rope* r, char* dst)
+{
+    return ropeCopy(r->root, dst);
+}
+
+/* first ')' of the subtree closing nothing when entered at depth num */
+static size_t ropeFirstClose(const struct parenth_rope_node* t, size_t num)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        if (t->left && t->left->sclose > num) {
+            t = t->left;
+            continue;
         }
-        else if (c == ')') {
-            num--;
-            if (num == 0) {
-                break;
+        if (t->left) {
+            num = num - t->left->sclose + t->left->sopen;
+            pos += t->left->len;
+        }
+        if (t->close > num) {
+            for (uint32_t i = 0;; i++) {
+                if (t->text[i] == '(') {
+                    num++;
+                }
+                else if (t->text[i] == ')' && num-- == 0) {
+                    return pos + i;
+                }
             }
         }
-        ++d;
+        num = num - t->close + t->open;
+        pos += t->n;
+        t = t->right;
     }
-    return d;
 }
 
-char* minRemoveToMakeValid(char* ss)
+/* first '(' of the subtree never closed when avail free ')' follow it */
+static size_t ropeFirstOpen(const struct parenth_rope_node* t, size_t avail)
+{
+    size_t pos = 0;
+
+    for (;;) {
+        size_t close = t->close, open = t->open, rclose = 0, ropen = 0;
+
+        if (t->right) {
+            rclose = t->right->sclose;
+            ropen = t->right->sopen;
+        }
+        parenthJoin(&rclose, &ropen, avail, 0);      /* what follows the block */
+        parenthJoin(&close, &open, rclose, ropen);  /* what follows the left subtree */
+        if (t->left && t->left->sopen > close) {
+            avail = close;
+            t = t->left;
+            continue;
+        }
+        if (t->left) {
+            pos += t->left->len;
+        }
+        if (t->open > rclose) {
+            size_t at = 0;
+
+            for (uint32_t i = t->n; i-- > 0; ) {
+                if (t->text[i] == ')') {
+                    rclose++;
+                }
+                else if (t->text[i] == '(') {
+                    if (rclose) {
+                        rclose--;
+                    }
+                    else {
+                        at = i;
+                    }
+                }
+            }
+            return pos + at;
+        }
+        pos += t->n;
+        t = t->right;
+    }
+}
+
+/**
+ * Balance state of the whole document, read from the root summary.
+ *
+ * @param err_pos : first offending position when unbalanced, as isBalanced
+ *                  reports it
+ *
+ * @return 1 if balanced, 0 otherwise
+ */
+int parenthRopeBalanced(const struct parenth_rope* r, size_t* err_pos)
+{
+    const struct parenth_rope_node* t = r->root;
+
+    if (!t || (t->sclose == 0 && t->sopen == 0)) {
+        return 1;
+    }
+    *err_pos = t->sclose ? ropeFirstClose(t, 0) : ropeFirstOpen(t, 0);
+    return 0;
+}
+
+#define PARENTH_STREAM_SPILL 1  /* buffer past the memory cap in a temporary file */
+
+#ifndef PARENTH_STREAM_DEPTH
+#define PARENTH_STREAM_DEPTH 65536  /* '(' held open at once, offsets kept in memory */
+#endif
+
+/*
+ * Streaming repair. Text read at depth 0 is final and passed through,
+ * ')' closing nothing are dropped on the spot. From a '(' at depth 0 on
+ * the text is held until the depth returns to 0, the '(' still open are
+ * those on the stack and are skipped when the held text is finally emitted.
+ */
+struct parenth_stream {
+    int (*emit)(void* arg, const char* s, size_t n);
+    void* arg;
+    size_t depth;
+    size_t* open;       /* held offsets of the '(' still open, depth entries, at most
+                           PARENTH_STREAM_DEPTH */
+    size_t open_size;
+    char* buf;          /* first bytes of the held text */
+    size_t size;
+    size_t cap;         /* memory limit of buf */
+    unsigned flags;
+    FILE* file;         /* rest of the held text */
+    size_t len;         /* held bytes */
+};
+
+/**
+ * @param emit  : output callback, returns 0 or an errno value which is then
+ *                returned by the stream functions
+ * @param cap   : most bytes held in memory, at least 1. The offsets of the
+ *                '(' held open take up to PARENTH_STREAM_DEPTH size_t more
+ * @param flags : PARENTH_STREAM_SPILL to hold more in a temporary file
+ *                instead of failing with EOVERFLOW
+ */
+void parenthStreamInit(struct parenth_stream* st, int (*emit)(void*, const char*, size_t), void* arg,
+                       size_t cap, unsigned flags)
+{
+    memset(st, 0, sizeof(*st));
+    st->emit = emit;
+    st->arg = arg;
+    st->cap = cap ? cap : 1;
+    st->flags = flags;
+}
+
+static int streamHold(struct parenth_stream* st, const char* s, size_t n)
+{
+    if (!st->file && st->len + n > st->size && st->size < st->cap) {
+        size_t size = st->size ? st->size : 256;
+        char* buf;
+
+        while (size < st->len + n && size < st->cap) {
+            size *= 2;
+        }
+        size = (size < st->cap) ? size : st->cap;
+        if (NULL == (buf = realloc(st->buf, size))) {
+            return ENOMEM;
+        }
+        st->buf = buf;
+        st->size = size;
+    }
+    if (st->len < st->size) {
+        size_t k = st->size - st->len;
+
+        k = (k < n) ? k : n;
+        memcpy(st->buf + st->len, s, k);
+        st->len += k;
+        s += k;
+        n -= k;
+    }
+    if (n) {
+        if (!(st->flags & PARENTH_STREAM_SPILL)) {
+            return EOVERFLOW;
+        }
+        if (!st->file && NULL == (st->file = tmpfile())) {
+            return errno;
+        }
+        if (fwrite(s, 1, n, st->file) != n) {
+            return EIO;
+        }
+        st->len += n;
+    }
+    return 0;
+}
+
+/* emit held bytes [base, base + n) from p, skipping the '(' still open */
+static int streamEmit(struct parenth_stream* st, const char* p, size_t n, size_t base, size_t* k)
+{
+    size_t i = 0;
+    int err;
+
+    for (; *k < st->depth && st->open[*k] < base + n; ++*k) {
+        size_t at = st->open[*k] - base;
+
+        if (at > i && 0 != (err = st->emit(st->arg, p + i, at - i))) {
+            return err;
+        }
+        i = at + 1;
+    }
+    return (n > i) ? st->emit(st->arg, p + i, n - i) : 0;
+}
+
+/* emit all held text, then start holding from scratch */
+static int streamRelease(struct parenth_stream* st)
+{
+    size_t mem = (st->len < st->size) ? st->len : st->size;
+    size_t k = 0;
+    int err = streamEmit(st, st->buf, mem, 0, &k);
+
+    if (st->len > mem && err == 0) {    /* read the spilled part back through buf */
+        size_t base = mem;
+
+        if (fflush(st->file) || fseek(st->file, 0, SEEK_SET)) {
+            return EIO;
+        }
+        while (base < st->len && err == 0) {
+            size_t n = st->len - base;
+
+            n = (n < st->size) ? n : st->size;
+            if (fread(st->buf, 1, n, st->file) != n) {
+                return EIO;
+            }
+            err = streamEmit(st, st->buf, n, base, &k);
+            base += n;
+        }
+        if (fseek(st->file, 0, SEEK_SET)) {     /* the file is reused */
+            return EIO;
+        }
+    }
+    st->len = 0;
+    return err;
+}
+
+/* 1 if s[0, n) can be written without exceeding the cap or the depth,
+   found by running the depth and the held length over it */
+static int streamFits(const struct parenth_stream* st, const char* s, size_t n)
+{
+    size_t depth = st->depth, held = st->len;
+    int spill = st->flags & PARENTH_STREAM_SPILL;
+
+    if ((spill || st->len + n <= st->cap) && n <= PARENTH_STREAM_DEPTH - st->depth) {
+        return 1;   /* not even n more bytes or '(' would exceed them */
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (depth == 0) {
+            if (s[i] == '(') {
+                depth = held = 1;
+            }
+            continue;
+        }
+        held++;
+        if (s[i] == '(' && ++depth > PARENTH_STREAM_DEPTH) {
+            return 0;
+        }
+        if (s[i] == ')' && --depth == 0) {
+            if (!spill && held > st->cap) {
+                return 0;
+            }
+            held = 0;
+        }
+    }
+    return spill || depth == 0 || held <= st->cap;
+}
+
+/**
+ * Repair the next n bytes of the stream. Output is emitted as soon as no
+ * later input can change it.
+ *
+ * @return 0, ENOMEM, EOVERFLOW when the held text exceeds the cap without
+ *         PARENTH_STREAM_SPILL or more than PARENTH_STREAM_DEPTH '(' are
+ *         open, EIO, or the error of emit. After EOVERFLOW nothing of s
+ *         was taken, the stream goes on with the next write
+ */
+int parenthStreamWrite(struct parenth_stream* st, const char* s, size_t n)
+{
+    size_t start = 0;
+    int err;
+
+    if (!streamFits(st, s, n)) {
+        return EOVERFLOW;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        if (st->depth == 0) {
+            if (s[i] != '(' && s[i] != ')') {
+                continue;
+            }
+            if (i > start && 0 != (err = st->emit(st->arg, s + start, i - start))) {
+                return err;
+            }
+            start = i + 1;
+            if (s[i] == ')') {      /* closes nothing */
+                continue;
+            }
+            start = i;
+        }
+        if (s[i] == '(') {
+            if (st->depth == st->open_size) {
+                size_t size = st->open_size ? 2 * st->open_size : 64;
+
+                size = (size < PARENTH_STREAM_DEPTH) ? size : PARENTH_STREAM_DEPTH;
+                size_t* open = realloc(st->open, size * sizeof(size_t));
+
+                if (open == NULL) {
+                    return ENOMEM;
+                }
+                st->open = open;
+                st->open_size = size;
+            }
+            st->open[st->depth++] = st->len + (i - start);
+        }
+        else if (s[i] == ')' && --st->depth == 0) {     /* the held text is final */
+            if (0 != (err = streamHold(st, s + start, i + 1 - start)) || 0 != (err = streamRelease(st))) {
+                return err;
+            }
+            start = i + 1;
+        }
+    }
+    if (n > start) {
+        return st->depth ? streamHold(st, s + start, n - start) : st->emit(st->arg, s + start, n - start);
+    }
+    return 0;
+}
+
+/**
+ * End of the stream : emit the held text without the '(' never closed and
+ * release the buffers.
+ */
+int parenthStreamFinish(struct parenth_stream* st)
+{
+    int err = streamRelease(st);
+
+    if (st->file) {
+        fclose(st->file);
+    }
+    free(st->buf);
+    free(st->open);
+    memset(st, 0, sizeof(*st));
+    return err;
+}
+
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+#ifdef BUILD_BENCH
+/*
+ * Adversarial benchmark, quadratic reference against the linear version
+ *
+ *     gcc -O2 -DBUILD_BENCH parenth.c -o parenth_bench && ./parenth_bench
+ */
+#include <time.h>
+
+/* previous implementation, rescans to the matching ')' from every '(' */
+static char* minRemoveToMakeValidQuadratic(char* ss)
 {
     char* s = ss;
     const char* d = ss;
     char c;
-    
+
     while ('\0' != (c = *d)) {
         switch (c) {
             case '(': {
@@ -53,8 +1654,182 @@ char* minRemoveToMakeValid(char* ss)
     return ss;
 }
 
-#include <stdio.h>
-#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    static const char* const shape[] = { "((((", "(a(b", ")(()" };
+    int fail = 0;
+
+    printf("%-6s %10s %12s %12s\n", "input", "bytes", "quadratic", "linear");
+    for (int k = 0; k < NELEMS(shape); k++) {
+        for (size_t n = 1 << 12; n <= 1 << 16; n <<= 1) {
+            char* a = malloc(n + 1);
+            char* b = malloc(n + 1);
+            double t0, t1, t2;
+
+            for (size_t i = 0; i < n; i++) {
+                a[i] = shape[k][i % 4];
+            }
+            a[n] = '\0';
+            memcpy(b, a, n + 1);
+
+            t0 = now();
+            minRemoveToMakeValidQuadratic(a);
+            t1 = now();
+            minRemoveToMakeValid(b);
+            t2 = now();
+            fail |= strcmp(a, b) != 0;
+            printf("%-6s %10zu %10.3fms %10.3fms%s\n", shape[k], n, (t1 - t0) * 1e3, (t2 - t1) * 1e3,
+                   strcmp(a, b) ? " MISMATCH" : "");
+            free(a);
+            free(b);
+        }
+    }
+
+    srand(1);
+    for (int i = 0; i < 100000; i++) {   /* random inputs */
+        char a[64], b[64];
+        int n = rand() % (sizeof(a) - 1);
+
+        for (int k = 0; k < n; k++) {
+            a[k] = "()x"[rand() % 3];
+        }
+        a[n] = '\0';
+        memcpy(b, a, n + 1);
+        if (strcmp(minRemoveToMakeValidQuadratic(a), minRemoveToMakeValid(b))) {
+            printf("MISMATCH %s\n", a);
+            fail = 1;
+        }
+    }
+    printf("%s random inputs\n", fail ? "FAIL" : "PASS");
+
+    {   /* balance check throughput on a large generated expression */
+        size_t n = 64 << 20, err_pos;
+        char* a = malloc(n);
+        double t0, t1, t2;
+        int r1, r2;
+
+        for (size_t i = 0; i < n; i++) {
+            a[i] = "f(a,(b+c)*g(d)),"[i % 16];
+        }
+        t0 = now();
+        r1 = isBalanced(a, n, &err_pos);
+        t1 = now();
+        r2 = isBalancedScalar(a, 0, n, 0, -1, &err_pos);
+        t2 = now();
+        printf("balance check %zuMB : block %.2fGB/s, scalar %.2fGB/s%s\n", n >> 20,
+               n / (t1 - t0) / 1e9, n / (t2 - t1) / 1e9, r1 == r2 && r1 ? "" : " MISMATCH");
+        fail |= !(r1 == r2 && r1);
+        free(a);
+    }
+
+    {   /* quote and comment aware check on source like text */
+        static const struct parenth_syntax c_syntax = { "\"'", '\\', "//", "/*", "*/" };
+        static const struct parenth_syntax str_syntax = { "\"", '\\', NULL, NULL, NULL };
+        static const char line[] = "    if (f(a, \"x(\\\"\", b[i])) { g(h(c) * (d + e)); } /* (x) */\n";
+        size_t n = 64 << 20, m = sizeof(line) - 1, err_pos;
+        char* a = malloc(n);
+
+        for (size_t i = 0; i < n; i++) {
+            a[i] = line[i % m];
+        }
+        n -= n % m;
+        for (int k = 0; k < 2; k++) {
+            const struct parenth_syntax* syn = k ? &str_syntax : &c_syntax;
+            double t0 = now(), t1, t2;
+            int r1 = isBalancedSyntax(a, n, syn, &err_pos), r2;
+
+            t1 = now();
+            r2 = syntaxCheck(a, n, syn, &err_pos, 0);
+            t2 = now();
+            printf("syntax check %s %zuMB : block %.2fGB/s, scalar %.2fGB/s%s\n", k ? "quotes" : "C", n >> 20,
+                   n / (t1 - t0) / 1e9, n / (t2 - t1) / 1e9, r1 == r2 && r1 ? "" : " MISMATCH");
+            fail |= !(r1 == r2 && r1);
+        }
+        free(a);
+    }
+
+    {   /* chunked repair scaling */
+        size_t n = 64 << 20;
+        char* a = malloc(n + 1);
+        char* b = malloc(n + 1);
+        double t0, t1;
+
+        for (size_t i = 0; i < n; i++) {
+            a[i] = "(a(b)c))("[i % 9];
+        }
+        a[n] = '\0';
+        for (unsigned t = 1; t <= 8; t <<= 1) {
+            t0 = now();
+            minRemoveToMakeValidParallel(a, n, b, t);
+            t1 = now();
+            printf("parallel repair %zuMB, %u threads : %.2fGB/s\n", n >> 20, t, n / (t1 - t0) / 1e9);
+        }
+        t0 = now();
+        minRemoveToMakeValid(a);
+        t1 = now();
+        printf("sequential repair %zuMB : %.2fGB/s%s\n", n >> 20, n / (t1 - t0) / 1e9, strcmp(a, b) ? " MISMATCH" : "");
+        fail |= strcmp(a, b) != 0;
+        free(a);
+        free(b);
+    }
+
+    {   /* keystrokes in a balanced document */
+        size_t n = 4 << 20, err_pos = 0;
+        char* a = malloc(n);
+        struct parenth_rope r;
+        double t0, t1;
+        int edits = 100000, ok = 1;
+
+        for (size_t i = 0; i < n; i++) {
+            a[i] = "f(a, (b)) + g(c);\n"[i % 18];
+        }
+        parenthRopeInit(&r, a, n);
+        t0 = now();
+        for (int i = 0; i < edits; i++) {
+            size_t pos = rand() % n;
+
+            parenthRopeEdit(&r, pos, 0, "(", 1);
+            ok &= !parenthRopeBalanced(&r, &err_pos) && err_pos <= pos;
+            parenthRopeEdit(&r, pos, 1, "", 0);
+            ok &= parenthRopeBalanced(&r, &err_pos);
+        }
+        t1 = now();
+        printf("rope edit %zuMB : %.0fns/edit%s, ", n >> 20, (t1 - t0) / (2 * edits) * 1e9, ok ? "" : " MISMATCH");
+        t0 = now();
+        ok = isBalanced(a, n, &err_pos);
+        t1 = now();
+        printf("full check %.0fns\n", (t1 - t0) * 1e9);
+        fail |= !ok;
+        parenthRopeFree(&r);
+        free(a);
+    }
+    return fail;
+}
+#else
+struct sink {
+    char* s;
+    size_t n, size;
+};
+
+static int sinkEmit(void* arg, const char* s, size_t n)
+{
+    struct sink* k = arg;
+
+    if (k->n + n > k->size) {
+        return ENOSPC;
+    }
+    memcpy(k->s + k->n, s, n);
+    k->n += n;
+    return 0;
+}
+
 int main()
 {
     struct {
@@ -67,6 +1842,9 @@ int main()
         {"))((", ""},
         {"a)b(c)d", "ab(c)d"},
         {"d(", "d"},
+        {"(a()", "a()"},
+        {"())()(((", "()()"},
+        {"", ""},
     };
     for (int i = 0; i < NELEMS(t); i++) {
         char input[32];
@@ -75,4 +1853,319 @@ int main()
          0 == strcmp(t[i].result, minRemoveToMakeValid(input)) ? "PASS" : "FAIL",
          t[i].input, input);
     }
-}
\ No newline at end of file
+    for (int i = 0; i < NELEMS(t); i++) {   /* slices of a larger buffer */
+        char input[40];
+        size_t len = strlen(t[i].input), n;
+
+        memcpy(input, t[i].input, len);
+        memcpy(input + len, ")(x", 4);
+        n = minRemoveToMakeValidLen(input, len);
+        printf("%s slice %d : %.*s\n", n == strlen(t[i].result) && 0 == memcmp(input, t[i].result, n)
+               && 0 == strcmp(input + len, ")(x") ? "PASS" : "FAIL", i, (int)n, input);
+    }
+    printf("%s matching brace slice\n", getMatchingBraceLen("a(b)c)d)", 8) == 5 && getMatchingBraceLen("a(b)c)d)", 5) == 5
+           && getMatchingBraceLen("", 0) == 0 && getMatchingBraceLen(")", 1) == 0 ? "PASS" : "FAIL");
+
+    struct {
+        const char* input;
+        int balanced;
+        size_t err_pos;
+    } b[] = {
+        {"f(a, g(b), (c)) + h(d)",                          1, 0},
+        {"f(a, g(b), (c)) + h(d)) + (e)",                   0, 22},
+        {"(((x) ((y)) (z)",                                 0, 0},
+        {"((((((((((((((((((((((((((((((((((((((((x))))))))))))))))))))))))))))))))))))))))", 1, 0},
+        {"(a)(b)(c)(d)(e)(f)(g)(h)(i)(j)(k)(l)(m)(n)(o)(p))", 0, 48},
+        {"", 1, 0},
+    };
+    for (int i = 0; i < NELEMS(b); i++) {
+        size_t err_pos = 0;
+        int r = isBalanced(b[i].input, strlen(b[i].input), &err_pos);
+        printf("%s balanced %d : %d %zu\n", r == b[i].balanced && (r || err_pos == b[i].err_pos) ? "PASS" : "FAIL",
+               i, r, err_pos);
+    }
+
+    {   /* block kernel against the scalar loop */
+        static char s[4096];
+        int fail = 0;
+
+        srand(1);
+        for (int i = 0; i < 20000 && !fail; i++) {
+            size_t len = rand() % sizeof(s), e1 = 0, e2 = 0;
+            int bias = rand() % 5;
+
+            for (size_t k = 0; k < len; k++) {
+                int r = rand() % 16;
+                s[k] = r < 5 + bias ? '(' : r < 12 ? ')' : 'x';
+            }
+            if (i & 1) {   /* balanced prefix then noise at the end */
+                size_t depth = 0;
+                for (size_t k = 0; k + depth < len; k++) {
+                    depth += (s[k] == '(') - (s[k] == ')' && depth > 0);
+                    s[k] = (s[k] == ')' && depth == 0) ? 'x' : s[k];
+                }
+            }
+            fail = isBalanced(s, len, &e1) != isBalancedScalar(s, 0, len, 0, -1, &e2) || e1 != e2;
+        }
+        printf("%s balanced random\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* chunked repair against the sequential one */
+        static char s[1024], ref[1024], dst[1024];
+        int fail = 0;
+
+        for (int i = 0; i < 20000 && !fail; i++) {
+            size_t len = rand() % (i < 1000 ? 16 : sizeof(s) - 1);
+            unsigned nthreads = 1 + rand() % 9;
+
+            for (size_t k = 0; k < len; k++) {
+                s[k] = "(()x)"[rand() % 5];
+            }
+            s[len] = '\0';
+            memcpy(ref, s, len + 1);
+            minRemoveToMakeValid(ref);
+            fail = minRemoveToMakeValidParallel(s, len, dst, nthreads) != strlen(ref) || strcmp(dst, ref);
+        }
+        printf("%s parallel random\n", fail ? "FAIL" : "PASS");
+    }
+
+    struct {
+        char input[32];
+        const char* result;
+    } m[] = {
+        {"{a[b(c)d]e}<f>",    "{a[b(c)d]e}<f>"},
+        {"([)]",              "[]"},
+        {"<a>{b]",            "<a>b"},
+        {"}{x(y]z)",          "x(yz)"},
+        {"[{(<",              ""},
+        {"lee(t(c)od(e)",     "leet(c)od(e)"},
+    };
+    for (int i = 0; i < NELEMS(m); i++) {
+        char input[32];
+        strcpy(input, m[i].input);
+        printf("%s %s => %s\n",
+         0 == minRemoveToMakeValidPairs(input) && 0 == strcmp(m[i].result, input) ? "PASS" : "FAIL",
+         m[i].input, input);
+    }
+
+    {   /* overflow leaves the input alone, '(' ')' only matches the counter path */
+        static char deep[BRACKET_STACK_MAX + 2], ref[64], s[64];
+        int fail = 0;
+
+        memset(deep, '{', BRACKET_STACK_MAX + 1);
+        printf("%s pairs overflow\n", EOVERFLOW == minRemoveToMakeValidPairs(deep)
+               && strspn(deep, "{") == BRACKET_STACK_MAX + 1 ? "PASS" : "FAIL");
+        deep[0] = ')';
+        printf("%s pairs deep\n", 0 == minRemoveToMakeValidPairs(deep) && deep[0] == '\0' ? "PASS" : "FAIL");
+
+        for (int i = 0; i < 20000 && !fail; i++) {
+            int n = rand() % (sizeof(s) - 1);
+            for (int k = 0; k < n; k++) {
+                s[k] = "()x"[rand() % 3];
+            }
+            s[n] = '\0';
+            memcpy(ref, s, n + 1);
+            fail = 0 != minRemoveToMakeValidPairs(s) || strcmp(s, minRemoveToMakeValid(ref));
+        }
+        printf("%s pairs random\n", fail ? "FAIL" : "PASS");
+    }
+
+    static const struct parenth_syntax c_syntax = { "\"'", '\\', "//", "/*", "*/" };
+    static const struct parenth_syntax str_syntax = { "\"", '\\', NULL, NULL, NULL };
+    struct {
+        const char* input;
+        const struct parenth_syntax* syn;
+        int balanced;
+        size_t err_pos;
+        const char* result;
+    } q[] = {
+        {"printf(\")\"); // (",                  &c_syntax,   1, 0,  "printf(\")\"); // ("},
+        {"f('(', \"\\\")\")",                  &c_syntax,   1, 0,  "f('(', \"\\\")\")"},
+        {"/* ( */ g(x /* ) */",                   &c_syntax,   0, 9,  "/* ( */ gx /* ) */"},
+        {"f(\")\")) // )\n(",                   &c_syntax,   0, 6,  "f(\")\") // )\n"},
+        {"a(\"(\"\\)b)",                         &str_syntax, 1, 0,  "a(\"(\"\\)b)"},
+        {"\\(x)",                               &str_syntax, 0, 3,  "\\(x"},
+    };
+    for (int i = 0; i < NELEMS(q); i++) {
+        char input[64];
+        size_t err_pos = 0;
+        int r = isBalancedSyntax(q[i].input, strlen(q[i].input), q[i].syn, &err_pos);
+
+        strcpy(input, q[i].input);
+        printf("%s syntax %d : %d %zu %s\n", r == q[i].balanced && (r || err_pos == q[i].err_pos)
+               && 0 == minRemoveToMakeValidSyntax(input, q[i].syn) && 0 == strcmp(input, q[i].result) ? "PASS" : "FAIL",
+               i, r, err_pos, input);
+    }
+
+    {   /* block paths against the byte at a time state machine */
+        static char s[1024];
+        const struct parenth_syntax* syns[] = { &c_syntax, &str_syntax };
+        const char* alphabets[] = { "()\"'\\/*\nxxxxxxxxxxxxxx", "(()))\"\\xxxxxxxx" };
+        int fail = 0;
+
+        for (int i = 0; i < 40000 && !fail; i++) {
+            int k = i & 1;
+            size_t len = rand() % sizeof(s), e1 = 0, e2 = 0;
+            size_t n = strlen(alphabets[k]);
+
+            for (size_t j = 0; j < len; j++) {
+                s[j] = alphabets[k][rand() % n];
+            }
+            if (i & 2) {   /* long runs of plain code */
+                for (size_t j = 0; j < len; j++) {
+                    s[j] = (rand() % 8) ? "x(x)"[j & 3] : s[j];
+                }
+            }
+            fail = isBalancedSyntax(s, len, syns[k], &e1) != syntaxCheck(s, len, syns[k], &e2, 0) || e1 != e2;
+        }
+        printf("%s syntax random\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* pair index against a stack walk */
+        static const char* const fixed[] = { "f(a, (b)) + g(c", ")x(()", "((a)(b))", "", "plain" };
+        static char s[300];
+        static size_t match[300], encl[300], depth[300], stack[300];
+        int fail = 0;
+
+        for (int i = 0; i < 5000 && !fail; i++) {
+            struct parenth_index idx;
+            size_t len, top = 0;
+
+            if (i < NELEMS(fixed)) {
+                len = strlen(fixed[i]);
+                memcpy(s, fixed[i], len);
+            }
+            else {
+                len = rand() % sizeof(s);
+                for (size_t k = 0; k < len; k++) {
+                    s[k] = "(()x)"[rand() % 5];
+                }
+            }
+            for (size_t k = 0; k < len; k++) {
+                match[k] = PARENTH_NOMATCH;
+                encl[k] = top ? stack[top - 1] : PARENTH_NOMATCH;
+                depth[k] = top;
+                if (s[k] == '(') {
+                    stack[top++] = k;
+                }
+                else if (s[k] == ')' && top) {
+                    match[k] = stack[--top];
+                    match[match[k]] = k;
+                    encl[k] = top ? stack[top - 1] : PARENTH_NOMATCH;
+                    depth[k] = top;
+                }
+            }
+            if (0 != parenthIndexBuild(&idx, s, len)) {
+                fail = 1;
+                break;
+            }
+            for (size_t k = 0; k < len; k++) {
+                fail |= parenthIndexMatch(&idx, k) != match[k] || parenthIndexEnclosing(&idx, k) != encl[k]
+                     || parenthIndexDepth(&idx, k) != depth[k];
+            }
+            fail |= parenthIndexMatch(&idx, len) != PARENTH_NOMATCH || parenthIndexDepth(&idx, len) != top;
+            parenthIndexFree(&idx);
+        }
+        printf("%s pair index\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* rope edits against a flat copy */
+        static char doc[20000], out[20000], ins[20000];
+        struct parenth_rope r;
+        size_t len = 0, err_pos = 0, rope_pos = 0;
+        int fail = parenthRopeInit(&r, "", 0);
+
+        for (int i = 0; i < 20000 && !fail; i++) {
+            size_t pos = len ? rand() % (len + 1) : 0;
+            size_t removed = (rand() % 4) ? 0 : rand() % (len - pos + 1) % 64;
+            size_t n = (rand() % 50) ? rand() % 3 : rand() % sizeof(ins);
+            int ok;
+
+            if (len - removed + n > sizeof(doc) - 1) {
+                removed = len - pos;
+                n = 0;
+            }
+            for (size_t k = 0; k < n; k++) {
+                ins[k] = "(()) x"[rand() % 6];
+            }
+            if (i % 200 == 0) {    /* replace the document by its repair */
+                doc[len] = '\0';
+                memcpy(ins, doc, len + 1);
+                minRemoveToMakeValid(ins);
+                pos = 0;
+                removed = len;
+                n = strlen(ins);
+            }
+            fail |= parenthRopeEdit(&r, pos, removed, ins, n);
+            memmove(doc + pos + n, doc + pos + removed, len - pos - removed);
+            memcpy(doc + pos, ins, n);
+            len = len - removed + n;
+
+            ok = isBalanced(doc, len, &err_pos);
+            fail |= parenthRopeLength(&r) != len || ok != parenthRopeBalanced(&r, &rope_pos) || (!ok && rope_pos != err_pos);
+            if (i % 1000 == 0) {
+                fail |= parenthRopeCopy(&r, out) != len || memcmp(out, doc, len);
+            }
+        }
+        fail |= parenthRopeEdit(&r, len, 1, "", 0) != EINVAL;
+        parenthRopeFree(&r);
+        printf("%s rope edits\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* streaming repair in random pieces, in memory and spilled */
+        static char s[4000], out[4000];
+        struct sink k = { out, 0, sizeof(out) };
+        struct parenth_stream st;
+        int fail = 0;
+
+        for (int i = 0; i < 3000 && !fail; i++) {
+            size_t len = rand() % sizeof(s), cap = (i % 3) ? 1 + rand() % 64 : len + 1;
+
+            for (size_t j = 0; j < len; j++) {
+                s[j] = "(()) x"[rand() % 6];
+            }
+            k.n = 0;
+            parenthStreamInit(&st, sinkEmit, &k, cap, PARENTH_STREAM_SPILL);
+            for (size_t j = 0; j < len; ) {
+                size_t n = rand() % 100;
+
+                n = (n < len - j) ? n : len - j;
+                fail |= parenthStreamWrite(&st, s + j, n);
+                j += n;
+            }
+            fail |= parenthStreamFinish(&st);
+            s[len] = '\0';
+            minRemoveToMakeValid(s);
+            fail |= k.n != strlen(s) || memcmp(out, s, k.n);
+        }
+
+        /* well formed input stays within a small cap */
+        parenthStreamInit(&st, sinkEmit, &k, 16, 0);
+        k.n = 0;
+        for (int i = 0; i < 100; i++) {
+            fail |= parenthStreamWrite(&st, "f(a, (b)) ", 10);
+        }
+        fail |= parenthStreamFinish(&st) || k.n != 1000;
+
+        /* a write that overflows is not taken, the stream goes on */
+        parenthStreamInit(&st, sinkEmit, &k, 16, 0);
+        k.n = 0;
+        fail |= parenthStreamWrite(&st, "a(b(c", 5);
+        fail |= parenthStreamWrite(&st, "((((((((((((((((((((", 20) != EOVERFLOW;
+        fail |= parenthStreamWrite(&st, "))d", 3) || parenthStreamFinish(&st) || k.n != 8 || memcmp(out, "a(b(c))d", 8);
+
+        /* the open offsets are bounded too, spilled or not */
+        {
+            static char deep[PARENTH_STREAM_DEPTH + 1];
+
+            memset(deep, '(', sizeof(deep));
+            parenthStreamInit(&st, sinkEmit, &k, 16, PARENTH_STREAM_SPILL);
+            k.n = 0;
+            fail |= parenthStreamWrite(&st, deep, PARENTH_STREAM_DEPTH) || st.open_size != PARENTH_STREAM_DEPTH;
+            fail |= parenthStreamWrite(&st, "x(", 2) != EOVERFLOW || parenthStreamWrite(&st, "x)y", 3);
+            fail |= parenthStreamFinish(&st) || k.n != 4 || memcmp(out, "(x)y", 4);
+        }
+        printf("%s stream\n", fail ? "FAIL" : "PASS");
+    }
+}
+#endif
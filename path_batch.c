@@ -0,0 +1,460 @@
+/******************************************************************************
+  @file   path_batch.c
+  @brief
+
+  DESCRIPTION: bulk simplify_path on a pool of worker threads.
+
+  path_batch_spans reduces an array of (ptr,len) paths in place, workers
+  taking blocks of paths from a shared counter. path_batch_split reduces
+  the paths of a delimiter separated buffer : the buffer is cut in one
+  chunk per worker at delimiters, each worker writes its reduced paths to
+  its own arena, and the arenas are then copied side by side into one
+  output buffer with the offset of every path.
+
+  The threads of a pool are created once and wait for work between calls.
+
+****************************************************************************/
+#define SIMPLIFY_PATH_LIB
+#include "simplify_path.c"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#define PATH_BATCH_MAX_THREADS  64
+#define PATH_BATCH_BLOCK        1024    /* paths taken at once by a worker */
+
+struct path_pool;
+
+struct path_worker {
+    struct path_pool* pool;
+    unsigned index;
+};
+
+struct path_pool {
+    pthread_mutex_t lock;
+    pthread_cond_t start, done;
+    pthread_t tid[PATH_BATCH_MAX_THREADS];
+    struct path_worker worker[PATH_BATCH_MAX_THREADS];
+    unsigned n;                 /* workers, the calling thread included */
+    unsigned round;             /* bumped for each job */
+    unsigned pending;           /* workers still running the job */
+    int stop;
+    void (*fn)(void* arg);
+    char* arg;                  /* argument of worker i at arg + i * size */
+    size_t size;
+};
+
+static void* path_pool_main(void* p)
+{
+    struct path_worker* w = p;
+    struct path_pool* pool = w->pool;
+    unsigned seen = 0;
+
+    for (;;) {
+        void (*fn)(void*);
+        void* arg;
+
+        pthread_mutex_lock(&pool->lock);
+        while (pool->round == seen && !pool->stop) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->round;
+        fn = pool->fn;
+        arg = pool->arg + w->index * pool->size;
+        pthread_mutex_unlock(&pool->lock);
+
+        fn(arg);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+/**
+ * Start nthreads - 1 workers, the thread running a job is the last one.
+ * Fewer are used when threads cannot be created.
+ */
+void path_pool_init(struct path_pool* pool, unsigned nthreads)
+{
+    nthreads = (nthreads == 0) ? 1 : (nthreads > PATH_BATCH_MAX_THREADS) ? PATH_BATCH_MAX_THREADS : nthreads;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->round = 0;
+    pool->pending = 0;
+    pool->stop = 0;
+    pool->n = 1;
+    while (pool->n < nthreads) {
+        struct path_worker* w = &pool->worker[pool->n];
+
+        w->pool = pool;
+        w->index = pool->n;
+        if (pthread_create(&pool->tid[pool->n], NULL, path_pool_main, w)) {
+            break;
+        }
+        pool->n++;
+    }
+}
+
+void path_pool_free(struct path_pool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (unsigned i = 1; i < pool->n; i++) {
+        pthread_join(pool->tid[i], NULL);
+    }
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/* fn(arg + i * size) on every worker i, returns when all are done */
+static void path_pool_run(struct path_pool* pool, void (*fn)(void*), void* arg, size_t size)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->size = size;
+    pool->pending = pool->n - 1;
+    pool->round++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    fn(arg);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending) {
+        pthread_cond_wait(&pool->done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+struct path_span {
+    char* p;
+    size_t len;
+};
+
+struct path_spans_job {
+    struct path_span* spans;
+    size_t n;
+    size_t next;                /* first path not taken */
+};
+
+static void path_spans_work(void* arg)
+{
+    struct path_spans_job* job = arg;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&job->next, PATH_BATCH_BLOCK, __ATOMIC_RELAXED)) < job->n) {
+        size_t end = (i + PATH_BATCH_BLOCK < job->n) ? i + PATH_BATCH_BLOCK : job->n;
+
+        for (; i < end; i++) {
+            job->spans[i].len = simplify_path_len(job->spans[i].p, job->spans[i].len);
+        }
+    }
+}
+
+/**
+ * simplify_path_len of every span, in place. The length of a path not
+ * beginning with '/' becomes 0.
+ */
+void path_batch_spans(struct path_pool* pool, struct path_span* spans, size_t n)
+{
+    struct path_spans_job job = { spans, n, 0 };
+
+    path_pool_run(pool, path_spans_work, &job, 0);
+}
+
+/* reduced paths of a delimiter separated buffer */
+struct path_batch {
+    char* data;                 /* reduced paths, each followed by the delimiter */
+    size_t len;
+    size_t* off;                /* start of path i, off[count] == len */
+    size_t count;
+};
+
+void path_batch_free(struct path_batch* out)
+{
+    free(out->data);
+    free(out->off);
+    out->data = NULL;
+    out->off = NULL;
+    out->len = out->count = 0;
+}
+
+struct path_split_chunk {
+    const char* s;
+    size_t begin, end;
+    char delim;
+    char* arena;                /* reduced paths of the chunk */
+    size_t len;
+    size_t* off;                /* their offsets in the arena */
+    size_t count;
+    struct path_batch* out;
+    size_t base, first;         /* where the chunk goes in out */
+    int err;
+};
+
+static void path_split_work(void* arg)
+{
+    struct path_split_chunk* c = arg;
+    const char* s = c->s + c->begin;
+    const char* end = c->s + c->end;
+    size_t count = 0;
+
+    for (const char* p = s; p < end; count++) {
+        const char* d = memchr(p, c->delim, end - p);
+
+        p = d ? d + 1 : end;
+    }
+    c->arena = malloc(c->end - c->begin + 1);
+    c->off = malloc((count + 1) * sizeof(size_t));
+    if (c->arena == NULL || c->off == NULL) {
+        c->err = ENOMEM;
+        return;
+    }
+    c->len = 0;
+    c->count = 0;
+    while (s < end) {
+        const char* d = memchr(s, c->delim, end - s);
+        size_t n = (d ? d : end) - s;
+
+        c->off[c->count++] = c->len;
+        memcpy(c->arena + c->len, s, n);
+        c->len += simplify_path_len(c->arena + c->len, n);
+        c->arena[c->len++] = c->delim;
+        s = d ? d + 1 : end;
+    }
+}
+
+static void path_split_copy(void* arg)
+{
+    struct path_split_chunk* c = arg;
+
+    memcpy(c->out->data + c->base, c->arena, c->len);
+    for (size_t i = 0; i < c->count; i++) {
+        c->out->off[c->first + i] = c->base + c->off[i];
+    }
+}
+
+/**
+ * Reduce the paths of s[0, len), separated by delim, into out. A last
+ * path without delimiter is a path, an empty or relative one is reduced
+ * to nothing. Free out with path_batch_free.
+ *
+ * @return 0 or ENOMEM
+ */
+int path_batch_split(struct path_pool* pool, const char* s, size_t len, char delim, struct path_batch* out)
+{
+    struct path_split_chunk c[PATH_BATCH_MAX_THREADS];
+    unsigned n = pool->n;
+    size_t at = 0;
+    int err = 0;
+
+    memset(c, 0, sizeof(c[0]) * n);
+    for (unsigned i = 0; i < n; i++) {    /* chunks end after a delimiter */
+        const char* d;
+
+        c[i].s = s;
+        c[i].delim = delim;
+        c[i].out = out;
+        c[i].begin = at;
+        at = (i + 1 == n) ? len : (len / n) * (i + 1);
+        if (at < c[i].begin) {
+            at = c[i].begin;
+        }
+        if (at > 0 && at < len && NULL != (d = memchr(s + at - 1, delim, len - at + 1))) {
+            at = d - s + 1;
+        }
+        else if (at > 0 && at < len) {
+            at = len;
+        }
+        c[i].end = at;
+    }
+    path_pool_run(pool, path_split_work, c, sizeof(c[0]));
+
+    out->len = 0;
+    out->count = 0;
+    for (unsigned i = 0; i < n; i++) {
+        err = err ? err : c[i].err;
+        c[i].base = out->len;
+        c[i].first = out->count;
+        out->len += c[i].len;
+        out->count += c[i].count;
+    }
+    out->data = err ? NULL : malloc(out->len + 1);
+    out->off = err ? NULL : malloc((out->count + 1) * sizeof(size_t));
+    if (out->data == NULL || out->off == NULL) {
+        err = ENOMEM;
+    }
+    else {
+        path_pool_run(pool, path_split_copy, c, sizeof(c[0]));
+        out->off[out->count] = out->len;
+    }
+    for (unsigned i = 0; i < n; i++) {
+        free(c[i].arena);
+        free(c[i].off);
+    }
+    if (err) {
+        path_batch_free(out);
+    }
+    return err;
+}
+
+#if defined(BUILD_TEST) || defined(BUILD_BENCH)
+#include <stdio.h>
+
+/* n random paths separated by '\n' into s, returns the length */
+static size_t make_paths(char* s, size_t n)
+{
+    static const char* const frag[] = { "usr", "lib", "x86_64-linux-gnu", "home", "user", ".config", "file.txt",
+                                        ".", "..", "", "..." };
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        int k = 2 + rand() % 8, dirty = rand() % 4 == 0;
+
+        if (rand() % 64 == 0) {
+            s[len++] = 'x';     /* relative */
+        }
+        while (k--) {
+            const char* f = frag[rand() % (dirty ? 11 : 7)];
+
+            s[len++] = '/';
+            memcpy(s + len, f, strlen(f));
+            len += strlen(f);
+        }
+        s[len++] = '\n';
+    }
+    return len;
+}
+#endif
+
+#ifdef BUILD_TEST
+/*
+ *     gcc -pthread -DBUILD_TEST path_batch.c -o path_batch && ./path_batch
+ */
+int main()
+{
+    enum { PATHS = 20000 };
+    static char s[PATHS * 100], t[PATHS * 100];
+    static struct path_span spans[PATHS];
+    int fail = 0;
+
+    for (unsigned threads = 1; threads <= 5; threads += 2) {
+        struct path_pool pool;
+
+        path_pool_init(&pool, threads);
+        for (int round = 0; round < 3; round++) {
+            size_t len = make_paths(s, PATHS - round * 7000), n = 0;
+            struct path_batch out;
+
+            memcpy(t, s, len);
+            fail |= path_batch_split(&pool, s, len - (round == 2), '\n', &out);
+
+            /* spans of the same paths, reduced in place */
+            for (char* p = t; p < t + len; n++) {
+                char* d = memchr(p, '\n', t + len - p);
+
+                spans[n].p = p;
+                spans[n].len = d - p;
+                p = d + 1;
+            }
+            path_batch_spans(&pool, spans, n);
+
+            fail |= out.count != n || out.off[n] != out.len;
+            for (size_t i = 0; i < n && !fail; i++) {
+                size_t k = out.off[i + 1] - out.off[i] - 1;
+                char* p = s + (spans[i].p - t);
+                size_t m = memchr(p, '\n', s + len - p) ? (size_t)((char*)memchr(p, '\n', s + len - p) - p) : 0;
+
+                m = simplify_path_len(p, m);
+                fail |= k != m || memcmp(out.data + out.off[i], p, m) || out.data[out.off[i] + k] != '\n'
+                        || spans[i].len != m || memcmp(spans[i].p, p, m);
+            }
+            path_batch_free(&out);
+        }
+        path_pool_free(&pool);
+    }
+    printf("%s batch\n", fail ? "FAIL" : "PASS");
+
+    {
+        struct path_pool pool;
+        struct path_batch out;
+
+        path_pool_init(&pool, 4);
+        fail = path_batch_split(&pool, "", 0, '\n', &out) || out.count != 0;
+        path_batch_free(&out);
+        fail |= path_batch_split(&pool, "/a/../b", 7, '\n', &out) || out.count != 1 || out.len != 3
+                || memcmp(out.data, "/b\n", 3);
+        path_batch_free(&out);
+        path_pool_free(&pool);
+        printf("%s small inputs\n", fail ? "FAIL" : "PASS");
+    }
+    return 0;
+}
+#endif
+
+#ifdef BUILD_BENCH
+/*
+ *     gcc -O2 -mavx2 -pthread -DBUILD_BENCH path_batch.c -o path_batch_bench && ./path_batch_bench
+ */
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    enum { PATHS = 4 << 20 };
+    char* s = malloc((size_t)PATHS * 100);
+    char* t = malloc((size_t)PATHS * 100);
+    struct path_span* spans = malloc(PATHS * sizeof(*spans));
+    size_t len = make_paths(s, PATHS);
+
+    printf("%d paths, %zuMB\n", PATHS, len >> 20);
+    for (unsigned threads = 1; threads <= 8; threads <<= 1) {
+        struct path_pool pool;
+        struct path_batch out;
+        double t0, t1, t2;
+        size_t n = 0;
+
+        memcpy(t, s, len);
+        for (char* p = t; p < t + len; n++) {
+            char* d = memchr(p, '\n', t + len - p);
+
+            spans[n].p = p;
+            spans[n].len = d - p;
+            p = d + 1;
+        }
+        path_pool_init(&pool, threads);
+        t0 = now();
+        path_batch_spans(&pool, spans, n);
+        t1 = now();
+        path_batch_split(&pool, s, len, '\n', &out);
+        t2 = now();
+        printf("%u threads : spans %.1fM paths/s, split %.1fM paths/s %.2fGB/s\n", pool.n,
+               n / (t1 - t0) / 1e6, n / (t2 - t1) / 1e6, len / (t2 - t1) / 1e9);
+        path_batch_free(&out);
+        path_pool_free(&pool);
+    }
+    free(spans);
+    free(t);
+    free(s);
+    return 0;
+}
+#endif
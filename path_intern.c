@@ -0,0 +1,487 @@
+/******************************************************************************
+  @file   path_intern.c
+  @brief
+
+  DESCRIPTION: interning store of canonical paths.
+
+  A path is a node of a trie of components : a node is its parent node and
+  the id of its last component name, 8 bytes. Paths sharing a prefix share
+  its nodes, and a name is stored once whatever the number of directories
+  it appears in, so /proc/sys/net/ipv4/conf/<if>/<param> costs a node per
+  distinct path and not a string. The (parent, name) table is kept up to
+  3/4 full and the arrays grow by half, to keep the slack per node small.
+
+  The node number is the id of the path. Ids are stable, equal paths have
+  equal ids, and a path is rebuilt from its id by walking the parents.
+  Inserting walks the canonical components of the raw path given by
+  simplify_iter, so the path is reduced as simplify_path would on the way
+  in and components cancelled by ".." are never added.
+
+****************************************************************************/
+#define SIMPLIFY_PATH_LIB
+#include "simplify_path.c"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PATH_INTERN_ROOT    0               /* id of "/" */
+#define PATH_INTERN_NONE    UINT32_MAX
+
+/* the tables are kept at most 3/4 full, the arrays grow by half */
+#define PATH_INTERN_FULL(n, mask)   (4 * ((size_t)(n) + 1) > 3 * ((mask) + 1))
+#define PATH_INTERN_GROW(cap)       ((cap) + (cap) / 2)
+
+struct path_node {
+    uint32_t parent;
+    uint32_t name;
+};
+
+struct path_intern {
+    struct path_node* node;     /* the paths, node[id] */
+    uint32_t nodes, node_cap;
+    uint32_t* child;            /* node ids by (parent, name), 0 is empty */
+    size_t child_mask;
+    char* pool;                 /* name i is pool[name_off[i], name_off[i + 1]) */
+    size_t pool_len, pool_cap;
+    uint32_t* name_off;
+    uint32_t names, name_cap;
+    uint32_t* name_tab;         /* name ids + 1 by name, 0 is empty */
+    size_t name_mask;
+};
+
+static inline uint64_t path_intern_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t path_intern_child_hash(uint32_t parent, uint32_t name)
+{
+    return path_intern_mix((uint64_t)parent << 32 | name);
+}
+
+static inline uint64_t path_intern_name_hash(const char* s, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (n--) {
+        h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    }
+    return path_intern_mix(h);
+}
+
+/**
+ * @return 0 or ENOMEM
+ */
+int path_intern_init(struct path_intern* pi)
+{
+    memset(pi, 0, sizeof(*pi));
+    pi->node_cap = 1024;
+    pi->name_cap = 256;
+    pi->pool_cap = 4096;
+    pi->child_mask = 2047;
+    pi->name_mask = 511;
+    pi->node = malloc(pi->node_cap * sizeof(*pi->node));
+    pi->child = calloc(pi->child_mask + 1, sizeof(*pi->child));
+    pi->pool = malloc(pi->pool_cap);
+    pi->name_off = malloc((pi->name_cap + 1) * sizeof(*pi->name_off));
+    pi->name_tab = calloc(pi->name_mask + 1, sizeof(*pi->name_tab));
+    if (!pi->node || !pi->child || !pi->pool || !pi->name_off || !pi->name_tab) {
+        free(pi->node);
+        free(pi->child);
+        free(pi->pool);
+        free(pi->name_off);
+        free(pi->name_tab);
+        return ENOMEM;
+    }
+    pi->node[PATH_INTERN_ROOT].parent = PATH_INTERN_ROOT;
+    pi->node[PATH_INTERN_ROOT].name = 0;
+    pi->nodes = 1;
+    pi->name_off[0] = 0;
+    return 0;
+}
+
+void path_intern_free(struct path_intern* pi)
+{
+    free(pi->node);
+    free(pi->child);
+    free(pi->pool);
+    free(pi->name_off);
+    free(pi->name_tab);
+}
+
+/* bytes used by the store */
+size_t path_intern_memory(const struct path_intern* pi)
+{
+    return pi->node_cap * sizeof(*pi->node) + (pi->child_mask + 1) * sizeof(*pi->child) + pi->pool_cap
+         + (pi->name_cap + 1) * sizeof(*pi->name_off) + (pi->name_mask + 1) * sizeof(*pi->name_tab);
+}
+
+static inline int path_intern_name_eq(const struct path_intern* pi, uint32_t name, const char* s, size_t n)
+{
+    return pi->name_off[name + 1] - pi->name_off[name] == n && 0 == memcmp(pi->pool + pi->name_off[name], s, n);
+}
+
+/* id of name s[0, n), PATH_INTERN_NONE if it was never added */
+static uint32_t path_intern_name(const struct path_intern* pi, const char* s, size_t n, uint64_t h)
+{
+    for (size_t i = h & pi->name_mask; pi->name_tab[i]; i = (i + 1) & pi->name_mask) {
+        if (path_intern_name_eq(pi, pi->name_tab[i] - 1, s, n)) {
+            return pi->name_tab[i] - 1;
+        }
+    }
+    return PATH_INTERN_NONE;
+}
+
+static uint32_t path_intern_child(const struct path_intern* pi, uint32_t parent, uint32_t name)
+{
+    for (size_t i = path_intern_child_hash(parent, name) & pi->child_mask; pi->child[i]; i = (i + 1) & pi->child_mask) {
+        const struct path_node* c = &pi->node[pi->child[i]];
+
+        if (c->parent == parent && c->name == name) {
+            return pi->child[i];
+        }
+    }
+    return PATH_INTERN_NONE;
+}
+
+/* double a table kept at most 3/4 full */
+static int path_intern_grow(uint32_t** tab, size_t* mask, uint64_t (*hash)(const struct path_intern*, uint32_t),
+                            const struct path_intern* pi)
+{
+    size_t m = *mask * 2 + 1;
+    uint32_t* t = calloc(m + 1, sizeof(*t));
+
+    if (t == NULL) {
+        return ENOMEM;
+    }
+    for (size_t i = 0; i <= *mask; i++) {
+        if ((*tab)[i]) {
+            size_t k = hash(pi, (*tab)[i]) & m;
+
+            while (t[k]) {
+                k = (k + 1) & m;
+            }
+            t[k] = (*tab)[i];
+        }
+    }
+    free(*tab);
+    *tab = t;
+    *mask = m;
+    return 0;
+}
+
+static uint64_t path_intern_child_rehash(const struct path_intern* pi, uint32_t id)
+{
+    return path_intern_child_hash(pi->node[id].parent, pi->node[id].name);
+}
+
+static uint64_t path_intern_name_rehash(const struct path_intern* pi, uint32_t id)
+{
+    return path_intern_name_hash(pi->pool + pi->name_off[id - 1], pi->name_off[id] - pi->name_off[id - 1]);
+}
+
+static uint32_t path_intern_add_name(struct path_intern* pi, const char* s, size_t n, uint64_t h)
+{
+    size_t i;
+
+    if (PATH_INTERN_FULL(pi->names, pi->name_mask)
+        && path_intern_grow(&pi->name_tab, &pi->name_mask, path_intern_name_rehash, pi)) {
+        return PATH_INTERN_NONE;
+    }
+    if (pi->names == pi->name_cap) {
+        size_t cap = PATH_INTERN_GROW((size_t)pi->name_cap);
+        uint32_t* off = realloc(pi->name_off, (cap + 1) * sizeof(*off));
+
+        if (off == NULL) {
+            return PATH_INTERN_NONE;
+        }
+        pi->name_off = off;
+        pi->name_cap = (uint32_t)cap;
+    }
+    if (pi->pool_len + n > pi->pool_cap) {
+        size_t cap = PATH_INTERN_GROW(pi->pool_cap) + n;
+        char* pool = (cap < UINT32_MAX) ? realloc(pi->pool, cap) : NULL;
+
+        if (pool == NULL) {
+            return PATH_INTERN_NONE;
+        }
+        pi->pool = pool;
+        pi->pool_cap = cap;
+    }
+    memcpy(pi->pool + pi->pool_len, s, n);
+    pi->pool_len += n;
+    pi->name_off[++pi->names] = (uint32_t)pi->pool_len;
+    for (i = h & pi->name_mask; pi->name_tab[i]; i = (i + 1) & pi->name_mask);
+    pi->name_tab[i] = pi->names;
+    return pi->names - 1;
+}
+
+static uint32_t path_intern_add_child(struct path_intern* pi, uint32_t parent, uint32_t name)
+{
+    size_t i;
+
+    if (pi->nodes == PATH_INTERN_NONE) {
+        return PATH_INTERN_NONE;
+    }
+    if (PATH_INTERN_FULL(pi->nodes, pi->child_mask)
+        && path_intern_grow(&pi->child, &pi->child_mask, path_intern_child_rehash, pi)) {
+        return PATH_INTERN_NONE;
+    }
+    if (pi->nodes == pi->node_cap) {
+        size_t cap = PATH_INTERN_GROW((size_t)pi->node_cap);
+        struct path_node* node;
+
+        cap = (cap < PATH_INTERN_NONE) ? cap : PATH_INTERN_NONE;
+        if (NULL == (node = realloc(pi->node, cap * sizeof(*node)))) {
+            return PATH_INTERN_NONE;
+        }
+        pi->node = node;
+        pi->node_cap = (uint32_t)cap;
+    }
+    pi->node[pi->nodes].parent = parent;
+    pi->node[pi->nodes].name = name;
+    for (i = path_intern_child_hash(parent, name) & pi->child_mask; pi->child[i]; i = (i + 1) & pi->child_mask);
+    pi->child[i] = pi->nodes;
+    return pi->nodes++;
+}
+
+/* walk the canonical components of path, adding the missing ones when
+   add is set. The path is reduced first by simplify_iter, so ".." never
+   meets a component that would be added only to be left */
+static int path_intern_walk(struct path_intern* pi, const char* path, size_t len, int add, uint32_t* id)
+{
+    struct simplify_iter it;
+    uint32_t cur = PATH_INTERN_ROOT;
+    const char* p;
+    size_t n;
+    int err = simplify_iter_init(&it, path, len);
+
+    if (err) {
+        return (err == EOVERFLOW) ? ENAMETOOLONG : err;
+    }
+    while (simplify_iter_next(&it, &p, &n)) {
+        uint64_t h = path_intern_name_hash(p, n);
+        uint32_t name = path_intern_name(pi, p, n, h);
+        uint32_t next = (name == PATH_INTERN_NONE) ? PATH_INTERN_NONE : path_intern_child(pi, cur, name);
+
+        if (next == PATH_INTERN_NONE) {
+            if (!add) {
+                *id = PATH_INTERN_NONE;
+                return ENOENT;
+            }
+            if (name == PATH_INTERN_NONE && PATH_INTERN_NONE == (name = path_intern_add_name(pi, p, n, h))) {
+                return ENOMEM;
+            }
+            if (PATH_INTERN_NONE == (next = path_intern_add_child(pi, cur, name))) {
+                return (pi->nodes == PATH_INTERN_NONE) ? EOVERFLOW : ENOMEM;
+            }
+        }
+        cur = next;
+    }
+    *id = cur;
+    return 0;
+}
+
+/**
+ * Id of the absolute path path[0, len), reduced as simplify_path would,
+ * added if it is new.
+ *
+ * @return 0, EINVAL if the path is relative, ENAMETOOLONG if more than
+ *         SIMPLIFY_ITER_DEPTH components are kept at once, ENOMEM, or
+ *         EOVERFLOW when the ids are exhausted
+ */
+int path_intern_add(struct path_intern* pi, const char* path, size_t len, uint32_t* id)
+{
+    return path_intern_walk(pi, path, len, 1, id);
+}
+
+/**
+ * @return id of the path, PATH_INTERN_NONE if it was never added
+ */
+uint32_t path_intern_find(const struct path_intern* pi, const char* path, size_t len)
+{
+    uint32_t id = PATH_INTERN_NONE;
+
+    path_intern_walk((struct path_intern*)pi, path, len, 0, &id);
+    return id;
+}
+
+/**
+ * Canonical path of id, nul terminated in dest when it fits. Written from
+ * the last component, right aligned, then moved to the start of dest.
+ *
+ * @return length of the path, without the nul
+ */
+size_t path_intern_get(const struct path_intern* pi, uint32_t id, char* dest, size_t dest_len)
+{
+    size_t pos = dest_len ? dest_len - 1 : 0, required = 0;
+
+    if (id == PATH_INTERN_ROOT) {
+        required = 1;
+        pos = (dest_len > 1) ? pos - 1 : 0;
+        if (dest_len > 1) {
+            dest[pos] = '/';
+        }
+    }
+    for (; id != PATH_INTERN_ROOT; id = pi->node[id].parent) {
+        uint32_t name = pi->node[id].name;
+        size_t n = pi->name_off[name + 1] - pi->name_off[name];
+
+        required += n + 1;
+        if (pos >= n + 1) {
+            pos -= n;
+            memcpy(dest + pos, pi->pool + pi->name_off[name], n);
+            dest[--pos] = '/';
+        }
+        else {
+            pos = 0;
+        }
+    }
+    if (dest_len > required) {
+        memmove(dest, dest + pos, required);
+        dest[required] = '\0';
+    }
+    return required;
+}
+
+#if defined(BUILD_TEST) || defined(BUILD_BENCH)
+#include <stdio.h>
+
+/* a /proc/sys like path into p */
+static size_t make_path(char* p, size_t size, int dirty)
+{
+    static const char* const net[] = { "ipv4", "ipv6" };
+    static const char* const param[] = { "arp_ignore", "arp_announce", "forwarding", "rp_filter", "accept_redirects",
+                                         "send_redirects", "proxy_arp", "disable_ipv6", "mtu", "accept_ra" };
+    static const char* const noise[] = { "/.", "//", "/x/..", "/../.." };
+
+    return snprintf(p, size, "/proc%s/sys/net/%s%s/conf/eth%d.%d/%s", dirty ? noise[rand() % 4] : "", net[rand() % 2],
+                    dirty ? noise[rand() % 4] : "", rand() % 64, rand() % 256, param[rand() % 10]);
+}
+#endif
+
+#ifdef BUILD_TEST
+/*
+ *     gcc -DBUILD_TEST path_intern.c -o path_intern && ./path_intern
+ */
+int main()
+{
+    enum { PATHS = 50000 };
+    static uint32_t ids[PATHS];
+    static char paths[PATHS][96];
+    struct path_intern pi;
+    size_t bytes = 0;
+    int fail = 0;
+
+    if (path_intern_init(&pi)) {
+        printf("FAIL init\n");
+        return 1;
+    }
+    for (int i = 0; i < PATHS && !fail; i++) {
+        char p[96];
+        size_t n = make_path(p, sizeof(p), i % 3 == 0);
+
+        fail |= path_intern_add(&pi, p, n, &ids[i]);
+        simplify_path(p);
+        strcpy(paths[i], p);
+        bytes += strlen(p) + 1;
+    }
+    for (int i = 0; i < PATHS && !fail; i++) {
+        char d[96];
+        size_t n = path_intern_get(&pi, ids[i], d, sizeof(d));
+        int k = rand() % PATHS;
+
+        fail |= n != strlen(paths[i]) || strcmp(d, paths[i]) || path_intern_find(&pi, d, n) != ids[i];
+        fail |= (ids[i] == ids[k]) != (0 == strcmp(paths[i], paths[k]));
+    }
+    fail |= path_intern_memory(&pi) >= bytes;   /* less than the strings, tables and slack included */
+    printf("%s %d paths, %zu bytes of strings, %zu bytes interned\n", fail ? "FAIL" : "PASS", PATHS, bytes,
+           path_intern_memory(&pi));
+
+    {
+        char d[16];
+        uint32_t id, root;
+
+        fail = path_intern_add(&pi, "/a/../..//", 10, &root) || root != PATH_INTERN_ROOT
+            || path_intern_get(&pi, root, d, sizeof(d)) != 1 || strcmp(d, "/")
+            || path_intern_add(&pi, "x/y", 3, &id) != EINVAL
+            || path_intern_find(&pi, "/proc/none", 10) != PATH_INTERN_NONE
+            || path_intern_find(&pi, "/nope/../proc/./sys", 19) != path_intern_find(&pi, "/proc/sys", 9)
+            || path_intern_find(&pi, "/proc/sys", 9) == PATH_INTERN_NONE
+            || path_intern_get(&pi, ids[0], d, sizeof(d)) != strlen(paths[0]);
+        id = pi.nodes;
+        fail |= path_intern_add(&pi, "/zzz/../proc/sys", 16, &root) || root != path_intern_find(&pi, "/proc/sys", 9)
+             || pi.nodes != id || path_intern_find(&pi, "/zzz", 4) != PATH_INTERN_NONE;
+        printf("%s edge cases\n", fail ? "FAIL" : "PASS");
+    }
+    path_intern_free(&pi);
+    return 0;
+}
+#endif
+
+#ifdef BUILD_BENCH
+/*
+ *     gcc -O2 -DBUILD_BENCH path_intern.c -o path_intern_bench && ./path_intern_bench
+ */
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    enum { PATHS = 1 << 21 };
+    char (*paths)[96] = malloc((size_t)PATHS * 96);
+    uint32_t* ids = malloc(PATHS * sizeof(*ids));
+    struct path_intern pi;
+    size_t bytes = 0, n = 0;
+    double t0, t1, t2;
+
+    for (int i = 0; i < PATHS; i++) {
+        make_path(paths[i], sizeof(paths[i]), 0);
+        bytes += strlen(paths[i]) + 1 + sizeof(char*);
+    }
+    path_intern_init(&pi);
+    t0 = now();
+    for (int i = 0; i < PATHS; i++) {
+        path_intern_add(&pi, paths[i], strlen(paths[i]), &ids[i]);
+    }
+    t1 = now();
+    for (int i = 0; i < PATHS; i++) {
+        char d[96];
+
+        n += path_intern_get(&pi, ids[i], d, sizeof(d));
+    }
+    t2 = now();
+    {   /* the distinct paths alone, as strings */
+        uint8_t* seen = calloc(pi.nodes, 1);
+        size_t distinct = 0, unique = 0;
+
+        for (int i = 0; i < PATHS; i++) {
+            if (!seen[ids[i]]) {
+                seen[ids[i]] = 1;
+                distinct += strlen(paths[i]) + 1 + sizeof(char*);
+                unique++;
+            }
+        }
+        printf("%d paths, %zu distinct : %zuMB as strings, %zuMB as distinct strings, %zuMB interned\n",
+               PATHS, unique, bytes >> 20, distinct >> 20, path_intern_memory(&pi) >> 20);
+        free(seen);
+    }
+    printf("add %.0fns, get %.0fns\n", (t1 - t0) / PATHS * 1e9, (t2 - t1) / PATHS * 1e9);
+    path_intern_free(&pi);
+    free(ids);
+    free(paths);
+    return n == 0;
+}
+#endif
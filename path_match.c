@@ -0,0 +1,764 @@
+/******************************************************************************
+  @file   path_match.c
+  @brief
+
+  DESCRIPTION: compiled allow and deny rules over paths.
+
+  A rule is an absolute path pattern whose components are names, "*" for
+  any one component or "**" for any number of components, none included.
+  The first rule matching a path decides, a path no rule matches is
+  denied.
+
+  The rules are compiled into a deterministic automaton over components :
+  a state is the set of rule positions reachable so far, wildcards are
+  merged into the literal transitions at compile time, so a path takes
+  one transition per component whatever the number of rules. The raw path
+  is matched as simplify_path would reduce it, "." is skipped and ".."
+  returns to the state of the parent from a stack, with no copy of the
+  path.
+
+****************************************************************************/
+#define SIMPLIFY_PATH_LIB
+#include "simplify_path.c"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define PATH_MATCH_DENY     0
+#define PATH_MATCH_ALLOW    1
+
+#define PATH_MATCH_DEPTH    256     /* components, deeper paths are denied */
+
+#define PATH_MATCH_STAR     0xfffffffeu
+#define PATH_MATCH_GLOBSTAR 0xfffffffdu
+
+struct path_rule {
+    const char* pattern;
+    int verdict;            /* PATH_MATCH_ALLOW or PATH_MATCH_DENY */
+};
+
+struct path_trans {
+    uint32_t state, name, next;
+};
+
+struct path_match {
+    struct path_trans* trans;   /* by (state, name), next 0 is empty */
+    size_t trans_mask;
+    uint32_t* other;            /* next state on a name of no pattern */
+    uint8_t* verdict;           /* of a path ending in the state */
+    uint32_t states;
+    char* pool;                 /* name i is pool[name_off[i], name_off[i + 1]) */
+    uint32_t* name_off;
+    uint32_t names;
+    uint32_t* name_tab;         /* name ids + 1 by name, 0 is empty */
+    size_t name_mask;
+};
+
+static inline uint64_t path_match_hash(const char* s, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (n--) {
+        h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    }
+    return h ^ (h >> 29);
+}
+
+static inline uint64_t path_match_trans_hash(uint32_t state, uint32_t name)
+{
+    uint64_t h = ((uint64_t)state << 32 | name) * 0x9e3779b97f4a7c15ULL;
+
+    return h ^ (h >> 29);
+}
+
+/* id of the name s[0, n), PATH_MATCH_STAR if no pattern has it */
+static inline uint32_t path_match_name(const struct path_match* m, const char* s, size_t n)
+{
+    for (size_t i = path_match_hash(s, n) & m->name_mask; m->name_tab[i]; i = (i + 1) & m->name_mask) {
+        uint32_t k = m->name_tab[i] - 1;
+
+        if (m->name_off[k + 1] - m->name_off[k] == n && 0 == memcmp(m->pool + m->name_off[k], s, n)) {
+            return k;
+        }
+    }
+    return PATH_MATCH_STAR;
+}
+
+static inline uint32_t path_match_next(const struct path_match* m, uint32_t state, uint32_t name)
+{
+    if (name != PATH_MATCH_STAR) {
+        for (size_t i = path_match_trans_hash(state, name) & m->trans_mask; m->trans[i].next; i = (i + 1) & m->trans_mask) {
+            if (m->trans[i].state == state && m->trans[i].name == name) {
+                return m->trans[i].next;
+            }
+        }
+    }
+    return m->other[state];
+}
+
+/**
+ * Verdict of the path[0, len) reduced as simplify_path would. Relative
+ * paths and paths deeper than PATH_MATCH_DEPTH are denied.
+ *
+ * @return PATH_MATCH_ALLOW or PATH_MATCH_DENY
+ */
+int path_match(const struct path_match* m, const char* path, size_t len)
+{
+    uint32_t stack[PATH_MATCH_DEPTH + 1];
+    const char* end = path + len;
+    const char* p = path;
+    size_t top = 0;
+
+    if (len == 0 || *path != '/') {
+        return PATH_MATCH_DENY;
+    }
+    stack[0] = 1;   /* the root */
+    while (p < end) {
+        const char* q;
+        size_t n;
+
+        p++;
+        q = memchr(p, '/', end - p);
+        q = q ? q : end;
+        n = q - p;
+        if (n == 0 || (n == 1 && p[0] == '.')) {
+            /* nothing */
+        }
+        else if (n == 2 && p[0] == '.' && p[1] == '.') {
+            top -= (top > 0);
+        }
+        else if (top == PATH_MATCH_DEPTH) {
+            return PATH_MATCH_DENY;
+        }
+        else {
+            stack[top + 1] = path_match_next(m, stack[top], path_match_name(m, p, n));
+            top++;
+        }
+        p = q;
+    }
+    return m->verdict[stack[top]];
+}
+
+void path_match_free(struct path_match* m)
+{
+    free(m->trans);
+    free(m->other);
+    free(m->verdict);
+    free(m->pool);
+    free(m->name_off);
+    free(m->name_tab);
+}
+
+/*
+ * Compilation. A rule position is (rule << 16 | component), a state of the
+ * automaton a sorted set of positions, found again through a hash table.
+ */
+struct path_compile {
+    uint32_t** comp;            /* name ids, PATH_MATCH_STAR or PATH_MATCH_GLOBSTAR */
+    uint32_t* ncomp;
+    size_t rules;
+    uint32_t* set;              /* positions of the states */
+    size_t set_len, set_cap;
+    size_t* set_off;            /* state i is set[set_off[i], set_off[i + 1]) */
+    size_t state_cap;
+    uint32_t* state_tab;        /* state ids by set, 0 is empty */
+    size_t state_mask;
+};
+
+static int path_pos_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* sort and dedup pos[0, n), returns the size */
+static size_t path_unique(uint32_t* pos, size_t n)
+{
+    size_t k = 0;
+
+    qsort(pos, n, sizeof(*pos), path_pos_cmp);
+    for (size_t i = 0; i < n; i++) {
+        if (k == 0 || pos[k - 1] != pos[i]) {
+            pos[k++] = pos[i];
+        }
+    }
+    return k;
+}
+
+/* add the positions "**" can skip to, sort and dedup, returns the size.
+   positions are added once each, pos has room for all of them twice */
+static size_t path_closure(const struct path_compile* c, uint32_t* pos, size_t n)
+{
+    uint32_t reach = 0;     /* last position added, of the rule of the previous one */
+    size_t k = 0;
+
+    n = path_unique(pos, n);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t j = pos[i];
+
+        if ((reach >> 16) == (j >> 16) && reach > j) {
+            j = reach;
+        }
+        while ((j & 0xffff) < c->ncomp[j >> 16] && c->comp[j >> 16][j & 0xffff] == PATH_MATCH_GLOBSTAR) {
+            pos[n + k++] = ++j;
+        }
+        reach = j;
+    }
+    return path_unique(pos, n + k);
+}
+
+static uint64_t path_set_hash(const uint32_t* pos, size_t n)
+{
+    return path_match_hash((const char*)pos, n * sizeof(*pos));
+}
+
+/* state of the set pos[0, n), added when new. returns 0 on ENOMEM */
+static uint32_t path_state(struct path_compile* c, struct path_match* m, const uint32_t* pos, size_t n)
+{
+    size_t i;
+
+    for (i = path_set_hash(pos, n) & c->state_mask; c->state_tab[i]; i = (i + 1) & c->state_mask) {
+        uint32_t s = c->state_tab[i];
+
+        if (c->set_off[s + 1] - c->set_off[s] == n && 0 == memcmp(c->set + c->set_off[s], pos, n * sizeof(*pos))) {
+            return s;
+        }
+    }
+    if (m->states + 2 > c->state_cap || 2 * (m->states + 1) > c->state_mask) {
+        size_t cap = 2 * c->state_cap, mask = 2 * c->state_mask + 1;
+        size_t* off = realloc(c->set_off, (cap + 1) * sizeof(*off));
+        uint32_t* tab = calloc(mask + 1, sizeof(*tab));
+
+        if (off) {
+            c->set_off = off;
+        }
+        if (!off || !tab) {
+            free(tab);
+            return 0;
+        }
+        for (uint32_t s = 1; s < m->states; s++) {
+            size_t k = path_set_hash(c->set + c->set_off[s], c->set_off[s + 1] - c->set_off[s]) & mask;
+
+            while (tab[k]) {
+                k = (k + 1) & mask;
+            }
+            tab[k] = s;
+        }
+        free(c->state_tab);
+        c->state_tab = tab;
+        c->state_mask = mask;
+        c->state_cap = cap;
+        for (i = path_set_hash(pos, n) & mask; tab[i]; i = (i + 1) & mask);
+    }
+    if (c->set_len + n > c->set_cap) {
+        uint32_t* set = realloc(c->set, (2 * c->set_cap + n) * sizeof(*set));
+
+        if (set == NULL) {
+            return 0;
+        }
+        c->set = set;
+        c->set_cap = 2 * c->set_cap + n;
+    }
+    memcpy(c->set + c->set_len, pos, n * sizeof(*pos));
+    c->set_len += n;
+    c->state_tab[i] = m->states;
+    c->set_off[m->states + 1] = c->set_len;
+    return m->states++;
+}
+
+static uint32_t path_add_name(struct path_match* m, const char* s, size_t n, size_t* pool_len)
+{
+    uint32_t k = path_match_name(m, s, n);
+    size_t i;
+
+    if (k != PATH_MATCH_STAR) {
+        return k;
+    }
+    memcpy(m->pool + *pool_len, s, n);
+    *pool_len += n;
+    m->name_off[++m->names] = (uint32_t)*pool_len;
+    for (i = path_match_hash(s, n) & m->name_mask; m->name_tab[i]; i = (i + 1) & m->name_mask);
+    m->name_tab[i] = m->names;
+    return m->names - 1;
+}
+
+/* the table has room, see path_grow_trans */
+static void path_add_trans(struct path_match* m, uint32_t state, uint32_t name, uint32_t next)
+{
+    size_t i;
+
+    for (i = path_match_trans_hash(state, name) & m->trans_mask; m->trans[i].next; i = (i + 1) & m->trans_mask);
+    m->trans[i].state = state;
+    m->trans[i].name = name;
+    m->trans[i].next = next;
+}
+
+static int path_grow_trans(struct path_match* m, size_t count)
+{
+    size_t mask = m->trans_mask;
+    struct path_trans* t;
+
+    if (2 * count <= mask + 1 && m->trans) {
+        return 0;
+    }
+    while (2 * count > mask + 1) {
+        mask = 2 * mask + 1;
+    }
+    if (NULL == (t = calloc(mask + 1, sizeof(*t)))) {
+        return ENOMEM;
+    }
+    for (size_t i = 0; m->trans && i <= m->trans_mask; i++) {
+        if (m->trans[i].next) {
+            size_t k = path_match_trans_hash(m->trans[i].state, m->trans[i].name) & mask;
+
+            while (t[k].next) {
+                k = (k + 1) & mask;
+            }
+            t[k] = m->trans[i];
+        }
+    }
+    free(m->trans);
+    m->trans = t;
+    m->trans_mask = mask;
+    return 0;
+}
+
+/* parse the patterns into component ids */
+static int path_match_parse(struct path_compile* c, struct path_match* m, const struct path_rule* rules, size_t n)
+{
+    size_t bytes = 0, comps = 0, pool_len = 0;
+
+    for (size_t r = 0; r < n; r++) {
+        size_t len = strlen(rules[r].pattern);
+
+        if (len == 0 || rules[r].pattern[0] != '/') {
+            return EINVAL;
+        }
+        bytes += len;
+        for (size_t i = 0; i < len; i++) {
+            comps += rules[r].pattern[i] == '/';
+        }
+    }
+    if (n > 0xffff) {
+        return EINVAL;
+    }
+    m->name_mask = 15;
+    while (m->name_mask + 1 < 2 * comps) {
+        m->name_mask = 2 * m->name_mask + 1;
+    }
+    m->pool = malloc(bytes + 1);
+    m->name_off = malloc((comps + 1) * sizeof(*m->name_off));
+    m->name_tab = calloc(m->name_mask + 1, sizeof(*m->name_tab));
+    c->comp = calloc(n, sizeof(*c->comp));
+    c->ncomp = calloc(n, sizeof(*c->ncomp));
+    if (!m->pool || !m->name_off || !m->name_tab || !c->comp || !c->ncomp) {
+        return ENOMEM;
+    }
+    m->name_off[0] = 0;
+    c->rules = n;
+
+    for (size_t r = 0; r < n; r++) {
+        const char* p = rules[r].pattern;
+        const char* end = p + strlen(p);
+
+        if (NULL == (c->comp[r] = malloc((end - p) * sizeof(uint32_t)))) {
+            return ENOMEM;
+        }
+        while (p < end) {
+            const char* q;
+            size_t k;
+
+            p++;
+            q = memchr(p, '/', end - p);
+            q = q ? q : end;
+            k = q - p;
+            if (k == 0 || (k == 1 && p[0] == '.')) {
+                /* nothing */
+            }
+            else if (k == 2 && p[0] == '.' && p[1] == '.') {
+                return EINVAL;
+            }
+            else if (c->ncomp[r] == 0xffff) {
+                return EINVAL;
+            }
+            else {
+                c->comp[r][c->ncomp[r]++] = (k == 1 && p[0] == '*') ? PATH_MATCH_STAR
+                                          : (k == 2 && p[0] == '*' && p[1] == '*') ? PATH_MATCH_GLOBSTAR
+                                          : path_add_name(m, p, k, &pool_len);
+            }
+            p = q;
+        }
+    }
+    return 0;
+}
+
+/* subset construction, states are numbered from 1 in discovery order */
+static int path_match_build(struct path_compile* c, struct path_match* m, const struct path_rule* rules)
+{
+    uint32_t *pos, *next, *names;
+    size_t trans = 0, n, positions = 0;
+    int err = ENOMEM;
+
+    /* a set has each position once, the closure may add as many again
+       before dedup. a rule with several "**" has several in one set */
+    for (size_t r = 0; r < c->rules; r++) {
+        positions += c->ncomp[r] + 1;
+    }
+    pos = malloc((2 * positions + 1) * sizeof(*pos));
+    next = malloc((2 * positions + 1) * sizeof(*next));
+    names = malloc((positions + 1) * sizeof(*names));
+    c->state_cap = 64;
+    c->state_mask = 127;
+    c->set_off = malloc((c->state_cap + 1) * sizeof(*c->set_off));
+    c->state_tab = calloc(c->state_mask + 1, sizeof(*c->state_tab));
+    if (!pos || !next || !names || !c->set_off || !c->state_tab || path_grow_trans(m, 64)) {
+        goto out;
+    }
+    c->set_off[0] = c->set_off[1] = 0;
+    m->states = 1;      /* 0 is not a state */
+
+    for (size_t r = 0; r < c->rules; r++) {
+        pos[r] = (uint32_t)r << 16;
+    }
+    n = path_closure(c, pos, c->rules);
+    if (!path_state(c, m, pos, n)) {
+        goto out;
+    }
+
+    for (uint32_t s = 1; s < m->states; s++) {
+        const uint32_t* set = c->set + c->set_off[s];
+        size_t size = c->set_off[s + 1] - c->set_off[s], nn = 0, k;
+        uint32_t other;
+
+        /* the names leaving the state, then the wildcard moves */
+        for (size_t i = 0; i < size; i++) {
+            uint32_t r = set[i] >> 16, j = set[i] & 0xffff;
+
+            if (j < c->ncomp[r] && c->comp[r][j] < PATH_MATCH_GLOBSTAR) {
+                names[nn++] = c->comp[r][j];
+            }
+        }
+        qsort(names, nn, sizeof(*names), path_pos_cmp);
+
+        for (size_t w = 0; w <= nn; w++) {
+            uint32_t name = (w < nn) ? names[w] : PATH_MATCH_STAR;
+
+            if (w > 0 && w < nn && names[w] == names[w - 1]) {
+                continue;
+            }
+            for (size_t i = k = 0; i < size; i++) {
+                uint32_t r = set[i] >> 16, j = set[i] & 0xffff;
+
+                if (j < c->ncomp[r] && (c->comp[r][j] == name || c->comp[r][j] == PATH_MATCH_STAR)) {
+                    next[k++] = set[i] + 1;
+                }
+                else if (j < c->ncomp[r] && c->comp[r][j] == PATH_MATCH_GLOBSTAR) {
+                    next[k++] = set[i];
+                }
+            }
+            k = path_closure(c, next, k);
+            other = path_state(c, m, next, k);
+            set = c->set + c->set_off[s];   /* the sets may have moved */
+            if (!other) {
+                goto out;
+            }
+            if (name == PATH_MATCH_STAR) {
+                continue;
+            }
+            if (path_grow_trans(m, ++trans)) {
+                goto out;
+            }
+            path_add_trans(m, s, name, other);
+        }
+    }
+
+    /* wildcard moves and verdicts, now that the states are known */
+    m->other = malloc(m->states * sizeof(*m->other));
+    m->verdict = malloc(m->states);
+    if (!m->other || !m->verdict) {
+        goto out;
+    }
+    for (uint32_t s = 1; s < m->states; s++) {
+        const uint32_t* set = c->set + c->set_off[s];
+        size_t size = c->set_off[s + 1] - c->set_off[s], k = 0;
+
+        m->verdict[s] = PATH_MATCH_DENY;
+        for (size_t i = 0; i < size; i++) {     /* sorted, the first rule ending here decides */
+            uint32_t r = set[i] >> 16, j = set[i] & 0xffff;
+
+            if (j == c->ncomp[r]) {
+                m->verdict[s] = rules[r].verdict ? PATH_MATCH_ALLOW : PATH_MATCH_DENY;
+                break;
+            }
+        }
+        for (size_t i = 0; i < size; i++) {
+            uint32_t r = set[i] >> 16, j = set[i] & 0xffff;
+
+            if (j < c->ncomp[r] && c->comp[r][j] == PATH_MATCH_STAR) {
+                next[k++] = set[i] + 1;
+            }
+            else if (j < c->ncomp[r] && c->comp[r][j] == PATH_MATCH_GLOBSTAR) {
+                next[k++] = set[i];
+            }
+        }
+        m->other[s] = path_state(c, m, next, path_closure(c, next, k));   /* known, never added */
+    }
+    err = 0;
+out:
+    free(pos);
+    free(next);
+    free(names);
+    return err;
+}
+
+/**
+ * Compile n rules, the first matching rule decides.
+ *
+ * @return 0, EINVAL for a relative pattern or one with "..", ENOMEM
+ */
+int path_match_compile(struct path_match* m, const struct path_rule* rules, size_t n)
+{
+    struct path_compile c;
+    int err;
+
+    memset(m, 0, sizeof(*m));
+    memset(&c, 0, sizeof(c));
+    err = path_match_parse(&c, m, rules, n);
+    if (err == 0) {
+        err = path_match_build(&c, m, rules);
+    }
+    for (size_t r = 0; c.comp && r < c.rules; r++) {
+        free(c.comp[r]);
+    }
+    free(c.comp);
+    free(c.ncomp);
+    free(c.set);
+    free(c.set_off);
+    free(c.state_tab);
+    if (err) {
+        path_match_free(m);
+        memset(m, 0, sizeof(*m));
+    }
+    return err;
+}
+
+#if defined(BUILD_TEST) || defined(BUILD_BENCH)
+#include <stdio.h>
+
+/* s and t past a '/', the patterns of the tests have no "." nor "//" */
+static int path_glob(const char* s, const char* t)
+{
+    size_t ls = strcspn(s, "/"), lt = strcspn(t, "/");
+
+    if (*s == '\0') {
+        return *t == '\0';
+    }
+    if (ls == 2 && s[0] == '*' && s[1] == '*') {
+        const char* r = s + ls + (s[ls] == '/');
+
+        for (;;) {
+            if (path_glob(r, t)) {
+                return 1;
+            }
+            if (*t == '\0') {
+                return 0;
+            }
+            t += strcspn(t, "/");
+            t += (*t == '/');
+        }
+    }
+    if (*t == '\0' || !((ls == 1 && s[0] == '*') || (ls == lt && 0 == memcmp(s, t, ls)))) {
+        return 0;
+    }
+    return path_glob(s + ls + (s[ls] == '/'), t + lt + (t[lt] == '/'));
+}
+
+/* reference : reduce a copy, then try the rules one by one */
+static int path_match_linear(const struct path_rule* rules, size_t n, const char* path, size_t len)
+{
+    char p[512];
+
+    if (len == 0 || len >= sizeof(p) || path[0] != '/') {
+        return PATH_MATCH_DENY;
+    }
+    memcpy(p, path, len);
+    p[len] = '\0';
+    simplify_path(p);
+    for (size_t r = 0; r < n; r++) {
+        if (path_glob(rules[r].pattern + 1, p + 1)) {
+            return rules[r].verdict;
+        }
+    }
+    return PATH_MATCH_DENY;
+}
+
+static const struct path_rule rules[] = {
+    { "/proc/sys/kernel/**",                        PATH_MATCH_DENY },
+    { "/proc/sys/net/ipv4/conf/*/arp_ignore",       PATH_MATCH_ALLOW },
+    { "/proc/sys/net/ipv4/conf/*/arp_announce",     PATH_MATCH_ALLOW },
+    { "/proc/sys/net/ipv4/conf/all/**",             PATH_MATCH_DENY },
+    { "/proc/sys/net/**/forwarding",                PATH_MATCH_ALLOW },
+    { "/proc/sys/net/ipv6/**",                      PATH_MATCH_DENY },
+    { "/proc/sys/net/**",                           PATH_MATCH_ALLOW },
+    { "/sys/class/net/*/mtu",                       PATH_MATCH_ALLOW },
+    { "/sys/**/power/*",                            PATH_MATCH_ALLOW },
+    { "/tmp",                                       PATH_MATCH_ALLOW },
+};
+#endif
+
+#ifdef BUILD_TEST
+/*
+ *     gcc -DBUILD_TEST path_match.c -o path_match && ./path_match
+ */
+/* a random path over the names of the rules */
+static size_t random_path(char* p, size_t size)
+{
+    static const char* const names[] = { "proc", "sys", "net", "ipv4", "ipv6", "conf", "all", "eth0", "arp_ignore",
+                                         "arp_announce", "forwarding", "kernel", "class", "mtu", "power", "tmp",
+                                         "x", ".", "..", "" };
+    size_t n = 0;
+    int k = rand() % 9;
+
+    while (k-- && n + 16 < size) {
+        const char* f = names[rand() % (sizeof(names) / sizeof(names[0]))];
+
+        n += snprintf(p + n, size - n, "/%s", f);
+    }
+    return n ? n : (size_t)snprintf(p, size, "/");
+}
+int main()
+{
+    static const struct {
+        const char* path;
+        int verdict;
+    } t[] = {
+        { "/proc/sys/net/ipv4/conf/bridge0.1/arp_ignore",   PATH_MATCH_ALLOW },
+        { "/proc/sys/net/ipv4/conf/all/arp_ignore",         PATH_MATCH_ALLOW },
+        { "/proc/sys/net/ipv4/conf/all/rp_filter",          PATH_MATCH_DENY },
+        { "/proc/sys/net/ipv6/conf/eth0/forwarding",        PATH_MATCH_ALLOW },
+        { "/proc/sys/net/ipv6/conf/eth0/mtu",               PATH_MATCH_DENY },
+        { "/proc/sys/net/core/somaxconn",                   PATH_MATCH_ALLOW },
+        { "/proc/sys/net/../kernel/panic",                  PATH_MATCH_DENY },
+        { "/proc/sys/kernel/../net/./core//somaxconn",      PATH_MATCH_ALLOW },
+        { "/sys/class/net/eth0/mtu",                        PATH_MATCH_ALLOW },
+        { "/sys/class/net/eth0/mtu/x/..",                   PATH_MATCH_ALLOW },
+        { "/sys/devices/a/b/power/control",                 PATH_MATCH_ALLOW },
+        { "/sys/power/state",                               PATH_MATCH_ALLOW },
+        { "/etc/passwd",                                    PATH_MATCH_DENY },
+        { "/tmp/",                                          PATH_MATCH_ALLOW },
+        { "/tmp/x",                                         PATH_MATCH_DENY },
+        { "/../tmp",                                        PATH_MATCH_ALLOW },
+        { "tmp",                                            PATH_MATCH_DENY },
+    };
+    struct path_match m;
+    int fail = 0;
+
+    if (path_match_compile(&m, rules, sizeof(rules) / sizeof(rules[0]))) {
+        printf("FAIL compile\n");
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(t) / sizeof(t[0]); i++) {
+        int v = path_match(&m, t[i].path, strlen(t[i].path));
+
+        printf("%s %s : %s\n", v == t[i].verdict ? "PASS" : "FAIL", t[i].path, v ? "allow" : "deny");
+    }
+    for (int i = 0; i < 200000 && !fail; i++) {
+        char p[256];
+        size_t n = random_path(p, sizeof(p));
+
+        fail |= path_match(&m, p, n) != path_match_linear(rules, sizeof(rules) / sizeof(rules[0]), p, n);
+        if (fail) {
+            printf("%.*s\n", (int)n, p);
+        }
+    }
+    printf("%s random, %u states\n", fail ? "FAIL" : "PASS", m.states - 1);
+    path_match_free(&m);
+
+    {   /* several "**" of one rule in a state */
+        static const struct path_rule stars[] = {
+            { "/**/x/**/x/**/x/tmp",    PATH_MATCH_ALLOW },
+            { "/**/**/x/**",            PATH_MATCH_DENY },
+            { "/**/tmp",                PATH_MATCH_ALLOW },
+        };
+        size_t k = sizeof(stars) / sizeof(stars[0]);
+
+        fail = path_match_compile(&m, stars, k) != 0;
+        for (int i = 0; i < 200000 && !fail; i++) {
+            char p[256];
+            size_t n = random_path(p, sizeof(p));
+
+            fail |= path_match(&m, p, n) != path_match_linear(stars, k, p, n);
+        }
+        fail |= fail || path_match(&m, "/x/x/a/x/tmp", 12) != PATH_MATCH_ALLOW;
+        printf("%s repeated globstars, %u states\n", fail ? "FAIL" : "PASS", m.states - 1);
+        path_match_free(&m);
+    }
+
+    {
+        struct path_rule bad[] = { { "/a/../b", PATH_MATCH_ALLOW } }, rel[] = { { "a", PATH_MATCH_ALLOW } };
+
+        printf("%s bad rules\n", path_match_compile(&m, bad, 1) == EINVAL && path_match_compile(&m, rel, 1) == EINVAL
+               ? "PASS" : "FAIL");
+    }
+    return 0;
+}
+#endif
+
+#ifdef BUILD_BENCH
+/*
+ *     gcc -O2 -DBUILD_BENCH path_match.c -o path_match_bench && ./path_match_bench
+ */
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    enum { PATHS = 1 << 16, RULES = 1000 };
+    static char paths[PATHS][96];
+    static size_t len[PATHS];
+    static char pat[RULES][96];
+    static struct path_rule many[RULES];
+    int fail = 0;
+
+    for (int i = 0; i < PATHS; i++) {
+        len[i] = snprintf(paths[i], sizeof(paths[i]), "/proc/sys/net/ipv4/conf/eth%d/%s", rand() % 1000,
+                          (rand() % 2) ? "arp_ignore" : "rp_filter");
+    }
+    for (int i = 0; i < RULES; i++) {   /* one rule per interface, then the wildcard rules */
+        snprintf(pat[i], sizeof(pat[i]), "/proc/sys/net/ipv4/conf/eth%d/arp_ignore", i);
+        many[i].pattern = (i < RULES - 10) ? pat[i] : rules[i - (RULES - 10)].pattern;
+        many[i].verdict = (i < RULES - 10) ? (i % 2) : rules[i - (RULES - 10)].verdict;
+    }
+    for (size_t k = 10; k <= RULES; k *= 10) {
+        const struct path_rule* r = (k == 10) ? rules : many + RULES - k;
+        struct path_match m;
+        double t0, t1, t2, t3;
+        int a = 0, b = 0;
+
+        t0 = now();
+        path_match_compile(&m, r, k);
+        t1 = now();
+        for (int i = 0; i < PATHS; i++) {
+            a += path_match(&m, paths[i], len[i]);
+        }
+        t2 = now();
+        for (int i = 0; i < PATHS; i++) {
+            b += path_match_linear(r, k, paths[i], len[i]);
+        }
+        t3 = now();
+        printf("%4zu rules, %u states : compile %.2fms, %.0fns/path, linear %.0fns/path%s\n", k, m.states - 1,
+               (t1 - t0) * 1e3, (t2 - t1) / PATHS * 1e9, (t3 - t2) / PATHS * 1e9, a == b ? "" : " MISMATCH");
+        fail |= a != b;
+        path_match_free(&m);
+    }
+    return fail;
+}
+#endif
@@ -0,0 +1,594 @@
+/******************************************************************************
+  @file   path_resolve.c
+  @brief
+
+  DESCRIPTION: symlink aware path resolution with a component cache.
+
+  simplify_path is lexical, ".." after a symbolic link gives the parent of
+  the link and not of its target. path_resolve returns the physical
+  canonical path as realpath(3) does, walking the path a component at a
+  time with readlinkat from a directory descriptor.
+
+  What is learned about each component is cached under its physical path :
+  a link and its target, a directory, or anything else. Repeated lookups
+  under the same directories are answered from the cache with no system
+  call. The cache is dropped by path_cache_invalidate, or, with
+  PATH_CACHE_INOTIFY, when inotify reports a change in a directory whose
+  entries were cached.
+
+****************************************************************************/
+#define _GNU_SOURCE
+#define SIMPLIFY_PATH_LIB
+#include "simplify_path.c"
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#define PATH_CACHE_INOTIFY      1   /* invalidate on inotify events */
+#define PATH_CACHE_PROBES       8   /* slots looked at by a lookup */
+#define PATH_RESOLVE_MAXLINKS   40  /* symbolic links followed, as the kernel */
+
+#define PATH_CACHE_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+enum path_kind {
+    PATH_KIND_PLAIN,    /* exists, not a link, not known as a directory */
+    PATH_KIND_DIR,
+    PATH_KIND_NOTDIR,
+    PATH_KIND_LINK,
+};
+
+struct path_cache_entry {
+    uint64_t hash;
+    uint32_t gen;       /* stale when not the cache generation */
+    uint32_t len;
+    uint8_t kind;
+    char* key;          /* physical path, nul, link target, nul */
+};
+
+struct path_cache {
+    struct path_cache_entry* slot;
+    size_t mask;
+    uint32_t gen;
+    int ifd;            /* inotify, -1 without PATH_CACHE_INOTIFY */
+    unsigned long syscalls;
+};
+
+static uint64_t path_hash(const char* s, size_t n)
+{
+    uint64_t h = 14695981039346656037ULL;
+
+    while (n--) {
+        h = (h ^ (uint8_t)*s++) * 1099511628211ULL;
+    }
+    return h;
+}
+
+/**
+ * @param slots : cache entries, rounded up to a power of two
+ * @param flags : PATH_CACHE_INOTIFY
+ *
+ * @return 0, ENOMEM, or the error of inotify_init1
+ */
+int path_cache_init(struct path_cache* c, size_t slots, unsigned flags)
+{
+    size_t n = PATH_CACHE_PROBES;
+
+    while (n < slots) {
+        n *= 2;
+    }
+    c->slot = calloc(n, sizeof(*c->slot));
+    if (c->slot == NULL) {
+        return ENOMEM;
+    }
+    c->mask = n - 1;
+    c->gen = 1;
+    c->syscalls = 0;
+    c->ifd = -1;
+    if ((flags & PATH_CACHE_INOTIFY) && 0 > (c->ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC))) {
+        free(c->slot);
+        return errno;
+    }
+    return 0;
+}
+
+void path_cache_free(struct path_cache* c)
+{
+    for (size_t i = 0; i <= c->mask; i++) {
+        free(c->slot[i].key);
+    }
+    free(c->slot);
+    if (c->ifd >= 0) {
+        close(c->ifd);
+    }
+}
+
+/* forget all entries, for changes the cache cannot see */
+void path_cache_invalidate(struct path_cache* c)
+{
+    c->gen++;
+}
+
+/* a change in a watched directory invalidates the cache */
+static void path_cache_poll(struct path_cache* c)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+
+    if (c->ifd < 0) {
+        return;
+    }
+    c->syscalls++;
+    while (read(c->ifd, buf, sizeof(buf)) > 0) {
+        c->gen++;
+        c->syscalls++;
+    }
+}
+
+static void path_cache_watch(struct path_cache* c, char* path, size_t len)
+{
+    char save = path[len];
+
+    if (c->ifd >= 0) {
+        path[len] = '\0';
+        inotify_add_watch(c->ifd, len ? path : "/", PATH_CACHE_EVENTS);
+        path[len] = save;
+        c->syscalls++;
+    }
+}
+
+static struct path_cache_entry* path_cache_find(struct path_cache* c, const char* key, size_t n, uint64_t h)
+{
+    for (size_t i = 0; i < PATH_CACHE_PROBES; i++) {
+        struct path_cache_entry* e = &c->slot[(h + i) & c->mask];
+
+        if (e->gen == c->gen && e->hash == h && e->len == n && 0 == memcmp(e->key, key, n)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* best effort, an entry not stored is looked up again next time */
+static void path_cache_put(struct path_cache* c, const char* key, size_t n, uint64_t h,
+                           enum path_kind kind, const char* target, size_t tn)
+{
+    struct path_cache_entry* e = &c->slot[h & c->mask];
+    char* k;
+
+    for (size_t i = 0; i < PATH_CACHE_PROBES; i++) {
+        struct path_cache_entry* f = &c->slot[(h + i) & c->mask];
+
+        if (f->gen != c->gen || (f->hash == h && f->len == n && 0 == memcmp(f->key, key, n))) {
+            e = f;
+            break;
+        }
+    }
+    if (NULL == (k = malloc(n + tn + 2))) {
+        return;
+    }
+    memcpy(k, key, n);
+    k[n] = '\0';
+    memcpy(k + n + 1, target, tn);
+    k[n + 1 + tn] = '\0';
+    free(e->key);
+    e->key = k;
+    e->hash = h;
+    e->gen = c->gen;
+    e->len = (uint32_t)n;
+    e->kind = kind;
+}
+
+/**
+ * Physical canonical path of path, relative paths start at the working
+ * directory. A canonical path (is_canonical_path) whose last component is
+ * cached as no link is answered with a single lookup.
+ *
+ * @param dest : nul terminated result
+ *
+ * @return 0, ERANGE if dest is too small, ENAMETOOLONG, ELOOP, or the
+ *         errors of the lookups (ENOENT, ENOTDIR, EACCES ...)
+ */
+int path_resolve(struct path_cache* c, const char* path, char* dest, size_t dest_len)
+{
+    char res[PATH_MAX + 1], rest[PATH_MAX + 1], link[PATH_MAX + 1], name[NAME_MAX + 1];
+    size_t n = strlen(path), rl = 0, head = 0, tail = n;
+    size_t fd_len = SIZE_MAX;   /* fd is res[0, fd_len), SIZE_MAX when it is not res[0, rl) */
+    int fd = -1, links = 0, err = 0;
+
+    path_cache_poll(c);
+    if (n == 0) {
+        return ENOENT;
+    }
+    if (n > PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+    if (path[0] == '/' && is_canonical_path(path, n)) {
+        struct path_cache_entry* e = path_cache_find(c, path, n, path_hash(path, n));
+
+        if (e && e->kind != PATH_KIND_LINK) {
+            if (n >= dest_len) {
+                return ERANGE;
+            }
+            memcpy(dest, path, n + 1);
+            return 0;
+        }
+    }
+    if (path[0] != '/') {
+        c->syscalls++;
+        if (NULL == getcwd(res, sizeof(res))) {
+            return errno;
+        }
+        rl = strlen(res);
+        rl = (rl == 1) ? 0 : rl;
+    }
+    memcpy(rest, path, n);
+
+    /* res[0, rl) is resolved, rest[head, tail) left to resolve */
+    while (head < tail) {
+        struct path_cache_entry* e;
+        const char* target;
+        size_t b, cl, tn;
+        uint64_t h;
+        int more;
+
+        while (head < tail && rest[head] == '/') {
+            head++;
+        }
+        if (head == tail) {
+            break;
+        }
+        for (b = head; head < tail && rest[head] != '/'; head++);
+        more = head < tail;     /* the component must be a directory */
+        n = head - b;
+
+        if (n == 1 && rest[b] == '.') {
+            continue;
+        }
+        if (n == 2 && rest[b] == '.' && rest[b + 1] == '.') {
+            while (rl > 0 && res[--rl] != '/');
+            fd_len = SIZE_MAX;
+            continue;
+        }
+        if (rl + 1 + n > PATH_MAX || n > NAME_MAX) {
+            err = ENAMETOOLONG;
+            break;
+        }
+        res[rl] = '/';
+        memcpy(res + rl + 1, rest + b, n);
+        cl = rl + 1 + n;
+        h = path_hash(res, cl);
+        e = path_cache_find(c, res, cl, h);
+
+        if (e && e->kind == PATH_KIND_LINK) {
+            target = e->key + e->len + 1;
+            tn = strlen(target);
+        }
+        else if (e && (e->kind == PATH_KIND_DIR || !more)) {
+            rl = cl;
+            fd_len = SIZE_MAX;
+            continue;
+        }
+        else if (e && e->kind == PATH_KIND_NOTDIR) {
+            err = ENOTDIR;
+            break;
+        }
+        else {
+            ssize_t ln;
+
+            if (fd_len != rl) {
+                char save = res[rl];
+
+                if (fd >= 0) {
+                    close(fd);
+                }
+                res[rl] = '\0';
+                fd = open(rl ? res : "/", O_PATH | O_DIRECTORY | O_CLOEXEC);
+                res[rl] = save;
+                c->syscalls++;
+                if (fd < 0) {
+                    err = errno;
+                    break;
+                }
+                fd_len = rl;
+                path_cache_watch(c, res, rl);
+            }
+            memcpy(name, rest + b, n);
+            name[n] = '\0';
+            c->syscalls++;
+            ln = readlinkat(fd, name, link, sizeof(link));
+            if (ln < 0 && errno != EINVAL) {
+                err = errno;
+                break;
+            }
+            if (ln < 0) {   /* not a link */
+                enum path_kind kind = PATH_KIND_PLAIN;
+
+                if (more) {     /* step the descriptor into the directory */
+                    int dfd = openat(fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+                    c->syscalls++;
+                    if (dfd < 0) {
+                        err = errno;
+                        if (err == ENOTDIR) {
+                            path_cache_put(c, res, cl, h, PATH_KIND_NOTDIR, "", 0);
+                        }
+                        break;
+                    }
+                    close(fd);
+                    fd = dfd;
+                    fd_len = cl;
+                    kind = PATH_KIND_DIR;
+                    path_cache_watch(c, res, cl);
+                }
+                else {
+                    fd_len = SIZE_MAX;
+                }
+                path_cache_put(c, res, cl, h, kind, "", 0);
+                rl = cl;
+                continue;
+            }
+            if ((size_t)ln == sizeof(link)) {
+                err = ENAMETOOLONG;
+                break;
+            }
+            path_cache_put(c, res, cl, h, PATH_KIND_LINK, link, ln);
+            target = link;
+            tn = ln;
+        }
+
+        /* continue with the link target followed by the rest */
+        if (++links > PATH_RESOLVE_MAXLINKS) {
+            err = ELOOP;
+            break;
+        }
+        if (tn + (tail - head) > PATH_MAX) {
+            err = ENAMETOOLONG;
+            break;
+        }
+        memmove(rest + tn, rest + head, tail - head);
+        memcpy(rest, target, tn);
+        tail = tn + (tail - head);
+        head = 0;
+        if (tn && target[0] == '/') {
+            rl = 0;
+            fd_len = SIZE_MAX;
+        }
+    }
+
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (err) {
+        return err;
+    }
+    if (rl == 0) {
+        res[rl++] = '/';
+    }
+    if (rl >= dest_len) {
+        return ERANGE;
+    }
+    memcpy(dest, res, rl);
+    dest[rl] = '\0';
+    return 0;
+}
+
+#if defined(BUILD_TEST) || defined(BUILD_BENCH)
+#include <sys/stat.h>
+
+static char tree[PATH_MAX];
+
+/* a tree of directories, files and links in a temporary directory */
+static int make_tree(void)
+{
+    static const char* const dirs[] = { "d1", "d1/d2", "d1/d2/d3", "d1/d2/d3/d4", "a", "a/b", "a/x", "a/x/d" };
+    static const char* const files[] = { "d1/d2/file", "a/b/y", "a/x/zz" };
+    static const char* const links[][2] = {
+        { "l1", "d1" },                 /* relative */
+        { "d1/l2", "../d1/d2" },        /* relative with .. */
+        { "abs", NULL },                /* absolute, to tree/d1 */
+        { "loop", "loop" },
+        { "dangling", "nowhere" },
+        { "d1/fl", "d2/file" },         /* to a file */
+        { "d1/d2/d3/up", "../.." },
+        { "a/x/y", "d" },               /* a file of the same name in a/b */
+    };
+    char p[PATH_MAX + 64], t[PATH_MAX + 64];
+    char tmpl[] = "/tmp/path_resolve.XXXXXX";
+    int fd;
+
+    if (NULL == mkdtemp(tmpl) || NULL == realpath(tmpl, tree)) {
+        return errno;
+    }
+    for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); i++) {
+        snprintf(p, sizeof(p), "%s/%s", tree, dirs[i]);
+        if (mkdir(p, 0700)) {
+            return errno;
+        }
+    }
+    for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); i++) {
+        snprintf(p, sizeof(p), "%s/%s", tree, files[i]);
+        if (0 > (fd = open(p, O_CREAT | O_WRONLY, 0600))) {
+            return errno;
+        }
+        close(fd);
+    }
+    for (size_t i = 0; i < sizeof(links) / sizeof(links[0]); i++) {
+        snprintf(p, sizeof(p), "%s/%s", tree, links[i][0]);
+        snprintf(t, sizeof(t), "%s/d1", tree);
+        if (symlink(links[i][1] ? links[i][1] : t, p)) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+static void remove_tree(void)
+{
+    char cmd[PATH_MAX + 16];
+
+    snprintf(cmd, sizeof(cmd), "rm -rf '%s'", tree);
+    if (system(cmd)) {
+        fprintf(stderr, "cannot remove %s\n", tree);
+    }
+}
+#endif
+
+#ifdef BUILD_TEST
+/*
+ *     gcc -DBUILD_TEST path_resolve.c -o path_resolve && ./path_resolve
+ */
+static const char* const paths[] = {
+    "", "l1/d2/file", "l1/l2/../d2/file", "abs/l2/file", "abs/l2/d3/up/l2/d3/up/fl", "loop", "dangling",
+    "d1/d2/file/x", "d1/fl", "d1/fl/", "./l1//d2/", "l1/..", "d1/d2/d3/d4/../../../..", "missing/x",
+};
+
+/* path_resolve against realpath(3), returns the paths that differ */
+static int check(struct path_cache* c, int print)
+{
+    int fail = 0;
+
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        char p[PATH_MAX + 64], r[PATH_MAX], d[PATH_MAX];
+        int err, rerr;
+
+        snprintf(p, sizeof(p), "%s/%s", tree, paths[i]);
+        errno = 0;
+        rerr = realpath(p, r) ? 0 : errno;
+        err = path_resolve(c, p, d, sizeof(d));
+        fail += err != rerr || (err == 0 && strcmp(d, r));
+        if (print) {
+            printf("%s %s : %d %s\n", (err != rerr || (err == 0 && strcmp(d, r))) ? "FAIL" : "PASS",
+                   paths[i], err, err ? "" : d + strlen(tree));
+        }
+    }
+    return fail;
+}
+
+static int relink(const char* name, const char* target)
+{
+    char p[PATH_MAX + 64];
+
+    snprintf(p, sizeof(p), "%s/%s", tree, name);
+    return unlink(p) || symlink(target, p);
+}
+
+int main()
+{
+    struct path_cache c;
+    char d[PATH_MAX], p[PATH_MAX + 64];
+    unsigned long syscalls;
+    int fail;
+
+    if (make_tree() || path_cache_init(&c, 256, 0)) {
+        printf("FAIL setup\n");
+        return 1;
+    }
+    check(&c, 1);
+    syscalls = c.syscalls;
+    fail = check(&c, 0);
+    syscalls = c.syscalls - syscalls;   /* only the missing and dangling targets are looked up again */
+    printf("%s cached, %lu system calls\n", fail == 0 && syscalls == 4 ? "PASS" : "FAIL", syscalls);
+
+    printf("%s relative : %s\n", 0 == path_resolve(&c, ".", d, sizeof(d)) && 0 == strcmp(d, getcwd(p, sizeof(p)))
+           ? "PASS" : "FAIL", d);
+    {   /* ".." then a cached directory whose path has the length of the one left */
+        char r[PATH_MAX];
+        int err;
+
+        snprintf(p, sizeof(p), "%s/a/x/zz", tree);
+        path_resolve(&c, p, d, sizeof(d));
+        snprintf(p, sizeof(p), "%s/a/b/../x/y", tree);
+        err = path_resolve(&c, p, d, sizeof(d));
+        printf("%s same length : %s\n", err == 0 && realpath(p, r) && 0 == strcmp(d, r) ? "PASS" : "FAIL",
+               err ? "" : d + strlen(tree));
+        err = path_resolve(&c, p, d, sizeof(d));
+        printf("%s same length cached\n", err == 0 && 0 == strcmp(d, r) ? "PASS" : "FAIL");
+    }
+    printf("%s short buffer\n", ERANGE == path_resolve(&c, "/", d, 1) && 0 == path_resolve(&c, "/", d, 2) ? "PASS" : "FAIL");
+
+    /* a changed link is seen after an explicit invalidation */
+    snprintf(p, sizeof(p), "%s/l1", tree);
+    relink("l1", "d1/d2");
+    path_resolve(&c, p, d, sizeof(d));
+    printf("%s stale until invalidated\n", 0 == strcmp(d + strlen(tree), "/d1") ? "PASS" : "FAIL");
+    path_cache_invalidate(&c);
+    path_resolve(&c, p, d, sizeof(d));
+    printf("%s invalidated : %s\n", 0 == strcmp(d + strlen(tree), "/d1/d2") && 0 == check(&c, 0) ? "PASS" : "FAIL",
+           d + strlen(tree));
+    path_cache_free(&c);
+
+    /* and at once with inotify */
+    relink("l1", "d1");
+    if (path_cache_init(&c, 256, PATH_CACHE_INOTIFY)) {
+        printf("FAIL inotify\n");
+    }
+    else {
+        fail = check(&c, 0) + check(&c, 0);
+        relink("l1", "d1/d2");
+        path_resolve(&c, p, d, sizeof(d));
+        fail |= strcmp(d + strlen(tree), "/d1/d2") != 0;
+        relink("l1", "d1");
+        fail |= check(&c, 0);
+        printf("%s inotify\n", fail ? "FAIL" : "PASS");
+        path_cache_free(&c);
+    }
+    remove_tree();
+    return 0;
+}
+#endif
+
+#ifdef BUILD_BENCH
+/*
+ *     gcc -O2 -DBUILD_BENCH path_resolve.c -o path_resolve_bench && ./path_resolve_bench
+ */
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    static const char* const paths[] = { "d1/d2/d3/d4", "l1/l2/d3/up/l2/d3/d4/..", "abs/l2/file", "d1/fl" };
+    enum { ROUNDS = 100000 };
+    struct path_cache c;
+    char p[4][PATH_MAX + 64], d[PATH_MAX], r[PATH_MAX];
+    int fail = 0;
+
+    if (make_tree() || path_cache_init(&c, 1024, 0)) {
+        return 1;
+    }
+    for (int i = 0; i < 4; i++) {
+        snprintf(p[i], sizeof(p[i]), "%s/%s", tree, paths[i]);
+    }
+    for (int k = 0; k < 3; k++) {
+        double t0 = now(), t1;
+        unsigned long syscalls = c.syscalls;
+
+        for (int i = 0; i < ROUNDS; i++) {
+            const char* q = p[i % 4];
+
+            if (k == 0) {
+                fail |= NULL == realpath(q, r);
+            }
+            else {
+                fail |= path_resolve(&c, q, d, sizeof(d));
+            }
+            if (k == 1) {
+                path_cache_invalidate(&c);
+            }
+        }
+        t1 = now();
+        printf("%s : %.0fns/path, %.1f system calls/path\n", k == 0 ? "realpath" : k == 1 ? "path_resolve cold" : "path_resolve warm",
+               (t1 - t0) / ROUNDS * 1e9, k ? (double)(c.syscalls - syscalls) / ROUNDS : 0.0);
+    }
+    path_cache_free(&c);
+    remove_tree();
+    return fail;
+}
+#endif
@@ -0,0 +1,823 @@
+/******************************************************************************
+  @file   shell_glob.c
+  @brief
+
+  DESCRIPTION: pathname expansion of shell words (*, ? and [...]).
+
+  Patterns are compiled once per word into per-component matchers. The
+  directories are read with getdents64 into a per-invocation cache, sorted
+  once and reused by every word and command expanded with the same cache,
+  so a script globbing the /sys/class/net entries repeatedly reads that
+  directory once.
+
+****************************************************************************/
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+
+#define ENOERR 0
+
+#define SHELL_GLOB_BUCKETS   64     /* directory cache hash buckets */
+#define SHELL_GLOB_MAX_COMP  32     /* path components of a pattern */
+#define SHELL_GLOB_MAX_OPS   128    /* matcher ops of a pattern */
+#define SHELL_GLOB_MAX_SETS  16     /* [...] classes of a pattern */
+
+/* one cached directory listing, names sorted */
+struct shell_glob_dir {
+    struct shell_glob_dir* next;    /* hash chain */
+    uint32_t hash;
+    size_t n;                       /* number of entries */
+    int is_dir;                     /* the path could be opened as a directory */
+    const char** names;
+    unsigned char* types;           /* d_type of each entry */
+    char* path;                     /* key, followed by the names */
+};
+
+struct shell_glob_cache {
+    struct shell_glob_dir* bucket[SHELL_GLOB_BUCKETS];
+    size_t reads;                   /* directories read from the kernel */
+};
+
+/**
+ * called for each pathname a word expands to
+ *
+ * @return 0 to continue, non zero to stop the expansion
+ */
+typedef int (*shell_glob_emit_fn)(void* ctx, const char* path, size_t len);
+
+/**
+ * Initialize an empty directory cache. A cache lives for one invocation,
+ * typically the execution of one script, as it is never invalidated.
+ */
+void shell_glob_cache_init(struct shell_glob_cache* cache);
+
+/* release all cached listings */
+void shell_glob_cache_free(struct shell_glob_cache* cache);
+
+/**
+ * Check whether a word has unquoted pattern characters.
+ *
+ * @return 1 if the word needs pathname expansion, 0 otherwise
+ */
+int shell_glob_has_magic(const char* word, size_t len);
+
+/**
+ * Expand a tokenized word to the pathnames it matches. Quotes and
+ * backslashes make the pattern characters they cover literal. Names
+ * starting with '.' match only a literal leading '.'. The matches of each
+ * directory are emitted in strcmp order. A word without matches emits
+ * nothing, the caller keeps the word as is like the shell does.
+ *
+ * @param cache : directory cache shared by the words of one invocation
+ * @param word : word as returned by the tokenizer, need not be nul terminated
+ * @param len : length of the word
+ * @param emit : callback for each match
+ * @param ctx : callback context
+ * @param count : optional output parameter to get the number of matches
+ * @return
+ *     ENOERR on success
+ *     ENAMETOOLONG if the word or a match exceeds PATH_MAX
+ *     E2BIG if the pattern exceeds the compiled pattern limits
+ *     ENOMEM if a listing could not be cached
+ *     the errno of getdents64 if a directory could not be read
+ */
+int shell_glob_expand(struct shell_glob_cache* cache, const char* word, size_t len,
+                      shell_glob_emit_fn emit, void* ctx, size_t* count);
+
+/* IMPLEMENTATION */
+
+enum glob_op_kind {
+    GLOB_OP_LIT,        /* literal run */
+    GLOB_OP_ANY,        /* ? */
+    GLOB_OP_STAR,       /* * */
+    GLOB_OP_SET,        /* [...] */
+};
+
+struct glob_op {
+    uint8_t kind;
+    uint8_t set;        /* GLOB_OP_SET : index of the class bitmap */
+    uint16_t len;       /* GLOB_OP_LIT : length of the run */
+    const char* lit;    /* GLOB_OP_LIT : run in the literal pool */
+};
+
+struct glob_comp {
+    const char* lit;    /* unquoted text of a component without magic */
+    size_t lit_len;
+    uint16_t op;        /* first op */
+    uint16_t nops;
+    uint8_t magic;
+    uint8_t dot;        /* pattern starts with a literal '.' */
+};
+
+struct glob_pat {
+    struct glob_comp comp[SHELL_GLOB_MAX_COMP];
+    size_t ncomp;
+    int dir_only;       /* word ends in '/' */
+    int absolute;
+    struct glob_op ops[SHELL_GLOB_MAX_OPS];
+    size_t nops;
+    uint8_t sets[SHELL_GLOB_MAX_SETS][32];
+    size_t nsets;
+    char pool[PATH_MAX];   /* unquoted literal text */
+    size_t npool;
+};
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static uint32_t glob_hash(const char* s, size_t len)
+{
+    uint32_t h = 2166136261u;   /* FNV-1a */
+    while (len--) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
+void shell_glob_cache_init(struct shell_glob_cache* cache)
+{
+    memset(cache, 0, sizeof(*cache));
+}
+
+void shell_glob_cache_free(struct shell_glob_cache* cache)
+{
+    for (size_t b = 0; b < SHELL_GLOB_BUCKETS; b++) {
+        struct shell_glob_dir* d = cache->bucket[b];
+        while (d) {
+            struct shell_glob_dir* next = d->next;
+            free(d->names);
+            free(d->types);
+            free(d->path);
+            free(d);
+            d = next;
+        }
+        cache->bucket[b] = NULL;
+    }
+}
+
+static int glob_name_cmp(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+/* read a directory once with getdents64, "." and ".." excluded */
+static int glob_dir_read(struct shell_glob_dir* d, const char* path, size_t plen)
+{
+    char buf[32 * 1024];
+    size_t used = plen + 1, cap = plen + 1 + 4096, n = 0, ncap = 0;
+    char* names = malloc(cap);
+    size_t* offs = NULL;
+    unsigned char* types = NULL;
+    int fd, rc = ENOERR;
+
+    if (NULL == names) {
+        return ENOMEM;
+    }
+    memcpy(names, path, plen);
+    names[plen] = '\0';
+
+    fd = open(plen ? names : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    d->is_dir = (fd >= 0);
+    while (fd >= 0) {
+        long nread = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (nread <= 0) {
+            rc = (nread < 0) ? errno : ENOERR;   /* a listing cut by an error is not cached */
+            break;
+        }
+        for (long pos = 0; pos < nread && rc == ENOERR; ) {
+            struct linux_dirent64* e = (struct linux_dirent64*)(buf + pos);
+            size_t nlen = strlen(e->d_name);
+            pos += e->d_reclen;
+            if (e->d_name[0] == '.' && (nlen == 1 || (nlen == 2 && e->d_name[1] == '.'))) {
+                continue;
+            }
+            if (n == ncap) {
+                size_t* o;
+                unsigned char* t;
+                ncap = ncap ? 2 * ncap : 64;
+                if (NULL != (o = realloc(offs, ncap * sizeof(*offs)))) {
+                    offs = o;
+                }
+                if (NULL != (t = realloc(types, ncap))) {
+                    types = t;
+                }
+                if (NULL == o || NULL == t) {
+                    rc = ENOMEM;
+                    break;
+                }
+            }
+            if (used + nlen + 1 > cap) {
+                char* m;
+                cap = 2 * (used + nlen + 1);
+                if (NULL == (m = realloc(names, cap))) {
+                    rc = ENOMEM;
+                    break;
+                }
+                names = m;
+            }
+            memcpy(names + used, e->d_name, nlen + 1);
+            offs[n] = used;
+            types[n] = e->d_type;
+            used += nlen + 1;
+            n++;
+        }
+        if (rc != ENOERR) {
+            break;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (rc != ENOERR) {
+        free(offs);
+        free(types);
+        free(names);
+        return rc;
+    }
+
+    /* the name pool is final, turn offsets into pointers and sort */
+    d->path = names;
+    d->n = n;
+    d->names = malloc((n ? n : 1) * sizeof(*d->names));
+    d->types = malloc(n ? n : 1);
+    if (NULL == d->names || NULL == d->types) {
+        free(offs);
+        free(types);
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < n; i++) {
+        d->names[i] = names + offs[i];
+    }
+    qsort(d->names, n, sizeof(*d->names), glob_name_cmp);
+    for (size_t i = 0; i < n; i++) {   /* types follow the sorted names */
+        size_t k = (size_t)(d->names[i] - names);
+        size_t lo = 0, hi = n;
+        while (lo < hi) {   /* offs is ascending, locate the entry of this name */
+            size_t mid = (lo + hi) / 2;
+            if (offs[mid] < k) lo = mid + 1; else hi = mid;
+        }
+        d->types[i] = types[lo];
+    }
+    free(offs);
+    free(types);
+    return ENOERR;
+}
+
+/* cached listing of a directory, read on first use */
+static int glob_dir_get(struct shell_glob_cache* cache, const char* path, size_t plen,
+                        const struct shell_glob_dir** out)
+{
+    uint32_t h = glob_hash(path, plen);
+    struct shell_glob_dir** slot = &cache->bucket[h % SHELL_GLOB_BUCKETS];
+    struct shell_glob_dir* d;
+    int rc;
+
+    for (d = *slot; d; d = d->next) {
+        if (d->hash == h && 0 == strncmp(d->path, path, plen) && d->path[plen] == '\0') {
+            *out = d;
+            return ENOERR;
+        }
+    }
+
+    d = calloc(1, sizeof(*d));
+    if (NULL == d) {
+        return ENOMEM;
+    }
+    if (ENOERR != (rc = glob_dir_read(d, path, plen))) {
+        free(d->names);
+        free(d->types);
+        free(d->path);
+        free(d);
+        return rc;
+    }
+    d->hash = h;
+    d->next = *slot;
+    *slot = d;
+    cache->reads++;
+    *out = d;
+    return ENOERR;
+}
+
+/* first entry not less than the first len bytes of key */
+static size_t glob_lower_bound(const struct shell_glob_dir* d, const char* key, size_t len)
+{
+    size_t lo = 0, hi = d->n;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (strncmp(d->names[mid], key, len) < 0) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+static int glob_pool_add(struct glob_pat* g, char c)
+{
+    if (g->npool >= sizeof(g->pool)) {
+        return ENAMETOOLONG;
+    }
+    g->pool[g->npool++] = c;
+    return ENOERR;
+}
+
+static struct glob_op* glob_op_add(struct glob_pat* g, struct glob_comp* c, uint8_t kind)
+{
+    struct glob_op* op;
+    if (g->nops >= SHELL_GLOB_MAX_OPS) {
+        return NULL;
+    }
+    op = &g->ops[g->nops++];
+    op->kind = kind;
+    op->set = 0;
+    op->len = 0;
+    op->lit = NULL;
+    c->nops++;
+    return op;
+}
+
+/* compile [...] starting at p (just after '['), returns the end of the class or NULL if not a class */
+static const char* glob_compile_set(const char* p, const char* end, uint8_t* set)
+{
+    int neg = 0;
+    const char* first;
+
+    memset(set, 0, 32);
+    if (p < end && (*p == '!' || *p == '^')) {
+        neg = 1;
+        p++;
+    }
+    first = p;
+    while (p < end && *p != '/' && (*p != ']' || p == first)) {
+        uint8_t lo = (uint8_t)*p++, hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']' && p[1] != '/') {
+            hi = (uint8_t)p[1];
+            p += 2;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            set[c >> 3] |= (uint8_t)(1u << (c & 7));
+        }
+    }
+    if (p >= end || *p != ']') {
+        return NULL;   /* unterminated, '[' is literal */
+    }
+    if (neg) {
+        for (int i = 0; i < 32; i++) {
+            set[i] = (uint8_t)~set[i];
+        }
+    }
+    return p + 1;
+}
+
+static int glob_compile(struct glob_pat* g, const char* word, size_t len)
+{
+    const char* p = word;
+    const char* end = word + len;
+    char quote = '\0';
+
+    g->ncomp = g->nops = g->nsets = g->npool = 0;
+    g->dir_only = 0;
+    g->absolute = (len && *word == '/');
+    while (p < end && *p == '/') p++;
+
+    while (p < end) {
+        struct glob_comp* c;
+        struct glob_op* lit = NULL;   /* literal run being extended */
+
+        if (g->ncomp >= SHELL_GLOB_MAX_COMP) {
+            return E2BIG;
+        }
+        c = &g->comp[g->ncomp++];
+        c->lit = g->pool + g->npool;
+        c->lit_len = 0;
+        c->op = (uint16_t)g->nops;
+        c->nops = 0;
+        c->magic = 0;
+        c->dot = 0;
+
+        for (; p < end && (quote || *p != '/'); p++) {
+            char ch = *p;
+            uint8_t kind = GLOB_OP_LIT;
+            const char* set_end = NULL;
+
+            if (quote) {
+                if (ch == quote) {
+                    quote = '\0';
+                    continue;
+                }
+            }
+            else if (ch == '\"' || ch == '\'') {
+                quote = ch;
+                continue;
+            }
+            else if (ch == '\\' && p + 1 < end) {
+                ch = *++p;
+            }
+            else if (ch == '*') {
+                kind = GLOB_OP_STAR;
+            }
+            else if (ch == '?') {
+                kind = GLOB_OP_ANY;
+            }
+            else if (ch == '[') {
+                uint8_t set[sizeof(g->sets[0])];
+                if (NULL != (set_end = glob_compile_set(p + 1, end, set))) {   /* else a literal '[' */
+                    if (g->nsets == SHELL_GLOB_MAX_SETS) {
+                        return E2BIG;
+                    }
+                    memcpy(g->sets[g->nsets], set, sizeof(set));
+                    kind = GLOB_OP_SET;
+                }
+            }
+
+            if (kind == GLOB_OP_LIT) {
+                if (ch == '.' && c->lit_len == 0 && c->nops == 0) {
+                    c->dot = 1;
+                }
+                if (ENOERR != glob_pool_add(g, ch)) {
+                    return ENAMETOOLONG;
+                }
+                c->lit_len++;
+                if (NULL == lit) {
+                    if (NULL == (lit = glob_op_add(g, c, GLOB_OP_LIT))) {
+                        return E2BIG;
+                    }
+                    lit->lit = g->pool + g->npool - 1;
+                }
+                lit->len++;
+                continue;
+            }
+
+            c->magic = 1;
+            lit = NULL;
+            if (kind == GLOB_OP_STAR && c->nops && g->ops[g->nops - 1].kind == GLOB_OP_STAR) {
+                continue;   /* ** is * within a component */
+            }
+            if (NULL == (lit = glob_op_add(g, c, kind))) {
+                return E2BIG;
+            }
+            if (kind == GLOB_OP_SET) {
+                lit->set = (uint8_t)g->nsets++;
+                p = set_end - 1;
+            }
+            lit = NULL;
+        }
+
+        if (c->lit_len == 0 && c->nops == 0) {
+            g->ncomp--;   /* empty component of a quoted "" */
+        }
+        if (p < end) {   /* at '/' */
+            while (p < end && *p == '/') p++;
+            if (p == end) {
+                g->dir_only = 1;
+            }
+        }
+    }
+    return ENOERR;
+}
+
+/* match a name against the ops of a component, backtracking to the last '*' only */
+static int glob_match(const struct glob_pat* g, const struct glob_comp* c, const char* s)
+{
+    const struct glob_op* ops = g->ops + c->op;
+    size_t n = strlen(s), oi = 0, si = 0, star_oi = SIZE_MAX, star_si = 0;
+
+    if (*s == '.' && !c->dot) {
+        return 0;   /* hidden names match a literal leading '.' only */
+    }
+
+    while (oi < c->nops || si < n) {
+        if (oi < c->nops) {
+            const struct glob_op* op = &ops[oi];
+            switch (op->kind) {
+            case GLOB_OP_STAR:
+                star_oi = oi++;
+                star_si = si;
+                continue;
+            case GLOB_OP_ANY:
+                if (si < n) {
+                    si++;
+                    oi++;
+                    continue;
+                }
+                break;
+            case GLOB_OP_SET:
+                if (si < n && (g->sets[op->set][(uint8_t)s[si] >> 3] & (1u << ((uint8_t)s[si] & 7)))) {
+                    si++;
+                    oi++;
+                    continue;
+                }
+                break;
+            default:
+                if (si + op->len <= n && 0 == memcmp(s + si, op->lit, op->len)) {
+                    si += op->len;
+                    oi++;
+                    continue;
+                }
+                break;
+            }
+        }
+        if (star_oi != SIZE_MAX && star_si < n) {   /* let the last '*' absorb one more byte */
+            si = ++star_si;
+            oi = star_oi + 1;
+            continue;
+        }
+        return 0;
+    }
+    return 1;
+}
+
+struct glob_walk {
+    struct shell_glob_cache* cache;
+    const struct glob_pat* g;
+    shell_glob_emit_fn emit;
+    void* ctx;
+    size_t count;
+    int stop;
+    char path[PATH_MAX];
+};
+
+static int glob_emit(struct glob_walk* w, size_t plen)
+{
+    if (w->g->dir_only) {
+        if (plen + 1 >= sizeof(w->path)) {
+            return ENAMETOOLONG;
+        }
+        w->path[plen++] = '/';
+    }
+    w->path[plen] = '\0';
+    w->count++;
+    if (w->emit(w->ctx, w->path, plen)) {
+        w->stop = 1;
+    }
+    return ENOERR;
+}
+
+/* could the entry be a directory we descend into? */
+static int glob_maybe_dir(unsigned char type)
+{
+    return type == DT_DIR || type == DT_LNK || type == DT_UNKNOWN;
+}
+
+static int glob_step(struct glob_walk* w, size_t ci, size_t plen)
+{
+    const struct glob_pat* g = w->g;
+    const struct glob_comp* c = &g->comp[ci];
+    int last = (ci + 1 == g->ncomp);
+    const struct shell_glob_dir* d;
+    const char* key = NULL;
+    size_t i = 0, prefix = 0;
+    int rc = ENOERR;
+
+    if (!c->magic && !last) {   /* literal directory, no listing needed */
+        if (plen + c->lit_len + 1 >= sizeof(w->path)) {
+            return ENAMETOOLONG;
+        }
+        memcpy(w->path + plen, c->lit, c->lit_len);
+        plen += c->lit_len;
+        w->path[plen++] = '/';
+        return glob_step(w, ci + 1, plen);
+    }
+
+    /* list the directory built so far, without its trailing '/' */
+    rc = glob_dir_get(w->cache, w->path, (plen > 1) ? plen - 1 : plen, &d);
+    if (ENOERR != rc) {
+        return rc;
+    }
+
+    if (!c->magic) {   /* literal last component, an existence check */
+        key = c->lit;
+        prefix = c->lit_len;
+    }
+    else if (g->ops[c->op].kind == GLOB_OP_LIT) {
+        key = g->ops[c->op].lit;
+        prefix = g->ops[c->op].len;
+    }
+    if (prefix) {   /* literal prefix, binary search its range of the sorted listing */
+        i = glob_lower_bound(d, key, prefix);
+    }
+
+    for (; i < d->n && !w->stop && rc == ENOERR; i++) {
+        const char* name = d->names[i];
+        size_t nlen;
+
+        if (prefix && 0 != strncmp(name, key, prefix)) {
+            break;   /* past the prefix range */
+        }
+        if (c->magic ? !glob_match(g, c, name) : name[prefix] != '\0') {
+            continue;
+        }
+        nlen = strlen(name);
+        if (plen + nlen + 1 >= sizeof(w->path)) {
+            return ENAMETOOLONG;
+        }
+        memcpy(w->path + plen, name, nlen);
+
+        if (last) {
+            if (!g->dir_only || glob_maybe_dir(d->types[i])) {
+                if (g->dir_only && d->types[i] != DT_DIR) {   /* resolve links through the cache */
+                    const struct shell_glob_dir* t;
+                    if (ENOERR != (rc = glob_dir_get(w->cache, w->path, plen + nlen, &t))) {
+                        return rc;
+                    }
+                    if (!t->is_dir) {
+                        continue;
+                    }
+                }
+                rc = glob_emit(w, plen + nlen);
+            }
+        }
+        else if (glob_maybe_dir(d->types[i])) {
+            w->path[plen + nlen] = '/';
+            rc = glob_step(w, ci + 1, plen + nlen + 1);
+        }
+    }
+    return rc;
+}
+
+int shell_glob_has_magic(const char* word, size_t len)
+{
+    char quote = '\0';
+
+    for (size_t i = 0; i < len; i++) {
+        char ch = word[i];
+        if (quote) {
+            if (ch == quote) quote = '\0';
+        }
+        else if (ch == '\"' || ch == '\'') {
+            quote = ch;
+        }
+        else if (ch == '\\') {
+            i++;
+        }
+        else if (ch == '*' || ch == '?' || ch == '[') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int shell_glob_expand(struct shell_glob_cache* cache, const char* word, size_t len,
+                      shell_glob_emit_fn emit, void* ctx, size_t* count)
+{
+    struct glob_pat* g;
+    struct glob_walk* w;
+    int rc = ENOERR;
+
+    if (NULL != count) {
+        *count = 0;
+    }
+    if (!shell_glob_has_magic(word, len)) {
+        return ENOERR;
+    }
+    if (len >= PATH_MAX) {
+        return ENAMETOOLONG;
+    }
+
+    g = malloc(sizeof(*g));
+    w = malloc(sizeof(*w));
+    if (NULL == g || NULL == w) {
+        free(g);
+        free(w);
+        return ENOMEM;
+    }
+
+    rc = glob_compile(g, word, len);
+    if (ENOERR == rc && g->ncomp) {
+        w->cache = cache;
+        w->g = g;
+        w->emit = emit;
+        w->ctx = ctx;
+        w->count = 0;
+        w->stop = 0;
+        w->path[0] = '/';
+        rc = glob_step(w, 0, g->absolute ? 1 : 0);
+        if (NULL != count) {
+            *count = w->count;
+        }
+    }
+
+    free(g);
+    free(w);
+    return rc;
+}
+
+#ifdef BUILD_TEST
+#include <stdio.h>
+#include <sys/stat.h>
+
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+struct collect {
+    char out[1024];
+    size_t n;
+    size_t skip;    /* prefix of each match not to collect */
+};
+
+static int collect(void* ctx, const char* path, size_t len)
+{
+    struct collect* c = ctx;
+    c->n += snprintf(c->out + c->n, sizeof(c->out) - c->n, "%s%.*s", c->n ? " " : "",
+                     (int)(len - c->skip), path + c->skip);
+    return 0;
+}
+
+int main(void)
+{
+    char root[] = "/tmp/shell_glob_XXXXXX";
+    char path[PATH_MAX];
+    const char* files[] = { "net/eth0/operstate", "net/eth1/operstate", "net/lo/operstate",
+                            "net/.hidden", "net/bond0", "etc/a.conf", "etc/b.conf", "etc/c.txt" };
+    struct {
+        const char* pattern;
+        const char* result;
+    } t[] = {
+        { "/net/*",                 "/net/bond0 /net/eth0 /net/eth1 /net/lo" },
+        { "/net/eth?/operstate",    "/net/eth0/operstate /net/eth1/operstate" },
+        { "/net/[!e]*",             "/net/bond0 /net/lo" },
+        { "/net/[a-e]*/",           "/net/eth0/ /net/eth1/" },
+        { "/net/*/",                "/net/eth0/ /net/eth1/ /net/lo/" },
+        { "/net/.*",                "/net/.hidden" },
+        { "/net/e*",                "/net/eth0 /net/eth1" },
+        { "/net/'e*'",              "" },
+        { "/net/\"eth\"*",          "/net/eth0 /net/eth1" },
+        { "/*/*.conf",              "/etc/a.conf /etc/b.conf" },
+        { "/etc/[ab].conf",         "/etc/a.conf /etc/b.conf" },
+        { "/nomatch*",              "" },
+    };
+    struct shell_glob_cache cache;
+    size_t reads = 0;
+    int fail = 0;
+
+    if (NULL == mkdtemp(root)) {
+        return 1;
+    }
+    for (int i = 0; i < NELEMS(files); i++) {
+        char* s;
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        for (s = strchr(path + strlen(root) + 1, '/'); s; s = strchr(s + 1, '/')) {
+            *s = '\0';
+            mkdir(path, 0700);
+            *s = '/';
+        }
+        close(open(path, O_WRONLY | O_CREAT, 0600));
+    }
+
+    shell_glob_cache_init(&cache);
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < NELEMS(t); i++) {
+            struct collect c = { .n = 0, .skip = strlen(root) };
+            size_t count;
+            int len = snprintf(path, sizeof(path), "%s%s", root, t[i].pattern);
+            int rc = shell_glob_expand(&cache, path, len, collect, &c, &count);
+            c.out[c.n] = '\0';
+            if (pass == 0) {
+                printf("%s %s => %s\n", rc == ENOERR && 0 == strcmp(c.out, t[i].result) ? "PASS" : "FAIL",
+                       t[i].pattern, c.out);
+            }
+            else if (rc != ENOERR || 0 != strcmp(c.out, t[i].result)) {
+                fail = 1;
+            }
+        }
+        if (pass == 0) {
+            reads = cache.reads;
+        }
+    }
+    printf("%s cache reused, %zu directory reads\n", !fail && reads == cache.reads ? "PASS" : "FAIL", reads);
+    {   /* one class past the limit fails instead of turning into a literal '[' */
+        struct collect c = { .n = 0, .skip = strlen(root) };
+        int len = snprintf(path, sizeof(path), "%s/net/", root), rc16, rc17;
+
+        for (int i = 0; i < SHELL_GLOB_MAX_SETS; i++) {
+            len += snprintf(path + len, sizeof(path) - len, "[a-z]");
+        }
+        rc16 = shell_glob_expand(&cache, path, len, collect, &c, NULL);
+        len += snprintf(path + len, sizeof(path) - len, "[a-z]");
+        rc17 = shell_glob_expand(&cache, path, len, collect, &c, NULL);
+        printf("%s %d classes\n", rc16 == ENOERR && rc17 == E2BIG ? "PASS" : "FAIL", SHELL_GLOB_MAX_SETS + 1);
+    }
+    shell_glob_cache_free(&cache);
+
+    for (int i = NELEMS(files) - 1; i >= 0; i--) {
+        char* s;
+        snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+        unlink(path);
+        while ((s = strrchr(path, '/')) && s > path + strlen(root)) {
+            *s = '\0';
+            rmdir(path);
+        }
+    }
+    rmdir(root);
+    return 0;
+}
+#endif
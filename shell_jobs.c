@@ -0,0 +1,585 @@
+/******************************************************************************
+  @file   shell_jobs.c
+  @brief
+
+  DESCRIPTION: execution of tokenized scripts with background jobs.
+
+  Commands terminated by '&' run concurrently up to a parallelism limit,
+  the others in the foreground. Each child is watched through a pidfd
+  opened at fork, the pidfds are the single epoll event loop and only the
+  ready ones are reaped with waitid(P_PIDFD). Other children of the caller
+  are left to it and SIGCHLD is neither blocked nor consumed.
+  `wait` waits for all the background jobs.
+
+  Words are split on blanks and their quotes removed, there is no
+  parameter or command substitution. Pipelines are not supported.
+
+****************************************************************************/
+#define _GNU_SOURCE
+#define SHELL_TOKEN_LIB
+#include "shell_token.c"
+
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define ENOERR 0
+
+#define SHELL_JOBS_MAX_ARGS  64      /* words of a command, NULL included */
+#define SHELL_JOBS_ARGBUF    4096    /* bytes of the words of a command */
+#define SHELL_JOBS_EVENTS    16      /* exits collected per epoll_wait */
+
+/* shell exit status of a waitid siginfo */
+#define SHELL_JOBS_STATUS(si) ((si).si_code == CLD_EXITED ? (si).si_status : 128 + (si).si_status)
+
+struct shell_jobs {
+    int epfd;               /* epoll set of the pidfds of the children */
+    int* jobs;              /* pidfds of the running background jobs */
+    size_t max_jobs;        /* parallelism limit */
+    size_t running;
+    int fg;                 /* pidfd of the foreground command, -1 once reaped */
+    int fg_status;
+    size_t failed;          /* background jobs that exited non zero */
+};
+
+/**
+ * Initialize a scheduler. The signal dispositions and mask of the caller
+ * are left as they are.
+ *
+ * @param jobs : table of max_jobs pidfds of the running jobs
+ * @param max_jobs : number of background jobs running at once
+ *
+ * @return 0 on success, errno value otherwise
+ */
+int shell_jobs_init(struct shell_jobs* js, int* jobs, size_t max_jobs);
+
+/* release the event loop, jobs still running are left to the caller */
+void shell_jobs_free(struct shell_jobs* js);
+
+/**
+ * Run a script. A command terminated by '&' starts once less than
+ * max_jobs background jobs run, an and-or list terminated by '&' runs in
+ * a child as one job. Background jobs may still run on return.
+ *
+ * @param status : exit status of the last foreground command
+ *
+ * @return
+ *     0 on success
+ *     ENOTSUP for pipelines and here-documents in background lists
+ *     E2BIG if a command has too many words
+ *     errno value of the failing call otherwise
+ */
+int shell_jobs_run(struct shell_jobs* js, const char* script, int* status);
+
+/**
+ * Wait for all the background jobs.
+ *
+ * @return 0 on success, errno value otherwise
+ */
+int shell_jobs_wait(struct shell_jobs* js);
+
+/* IMPLEMENTATION */
+
+int shell_jobs_init(struct shell_jobs* js, int* jobs, size_t max_jobs)
+{
+    if (max_jobs == 0) {
+        return EINVAL;
+    }
+
+    js->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (js->epfd < 0) {
+        return errno;
+    }
+
+    js->jobs = jobs;
+    js->max_jobs = max_jobs;
+    js->running = 0;
+    js->fg = -1;
+    js->fg_status = 0;
+    js->failed = 0;
+    return ENOERR;
+}
+
+void shell_jobs_free(struct shell_jobs* js)
+{
+    for (size_t i = 0; i < js->running; i++) {
+        close(js->jobs[i]);
+    }
+    js->running = 0;
+    close(js->epfd);
+}
+
+/* fork a child watched by the event loop through a pidfd, returns the pid
+   as fork does. a child that cannot be watched is killed and reaped */
+static pid_t shell_jobs_fork(struct shell_jobs* js, int* pidfd)
+{
+    struct epoll_event ev;
+    pid_t pid = fork();
+    int rc;
+
+    if (pid <= 0) {
+        return pid;
+    }
+    *pidfd = (int)syscall(SYS_pidfd_open, pid, 0);   /* close on exec */
+    ev.events = EPOLLIN;
+    ev.data.fd = *pidfd;
+    if (*pidfd >= 0 && 0 == epoll_ctl(js->epfd, EPOLL_CTL_ADD, *pidfd, &ev)) {
+        return pid;
+    }
+    rc = errno;
+    if (*pidfd >= 0) {
+        close(*pidfd);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    errno = rc;
+    return -1;
+}
+
+/* block until children of the scheduler exit, then reap the ready ones.
+   other children of the process are not waited for */
+static int shell_jobs_reap(struct shell_jobs* js)
+{
+    struct epoll_event ev[SHELL_JOBS_EVENTS];
+    int n = epoll_wait(js->epfd, ev, SHELL_JOBS_EVENTS, -1);
+
+    if (n < 0) {
+        return (errno == EINTR) ? ENOERR : errno;   /* a handler of the caller ran */
+    }
+
+    for (int k = 0; k < n; k++) {
+        int fd = ev[k].data.fd;
+        siginfo_t si;
+
+        si.si_pid = 0;
+        if (waitid(P_PIDFD, fd, &si, WEXITED | WNOHANG) < 0) {
+            return errno;
+        }
+        if (si.si_pid == 0) {
+            continue;
+        }
+        /* a child not yet past exec may hold a copy of the pidfd, closing
+           it alone would leave it in the epoll set */
+        epoll_ctl(js->epfd, EPOLL_CTL_DEL, fd, NULL);
+        close(fd);
+        if (fd == js->fg) {
+            js->fg = -1;
+            js->fg_status = SHELL_JOBS_STATUS(si);
+            continue;
+        }
+        for (size_t i = 0; i < js->running; i++) {
+            if (js->jobs[i] == fd) {
+                js->jobs[i] = js->jobs[--js->running];
+                js->failed += (SHELL_JOBS_STATUS(si) != 0);
+                break;
+            }
+        }
+    }
+    return ENOERR;
+}
+
+int shell_jobs_wait(struct shell_jobs* js)
+{
+    int rc = ENOERR;
+
+    while (js->running && rc == ENOERR) {
+        rc = shell_jobs_reap(js);
+    }
+    return rc;
+}
+
+/* wait for a free job slot */
+static int shell_jobs_slot(struct shell_jobs* js)
+{
+    int rc = ENOERR;
+
+    while (js->running == js->max_jobs && rc == ENOERR) {
+        rc = shell_jobs_reap(js);
+    }
+    return rc;
+}
+
+/* copy the words of [p, end) to argv with their quotes removed, the words
+   are stored from *buf on */
+static int shell_jobs_words(const char* p, const char* end, char** argv, size_t* argc, size_t max,
+    char** buf, char* buf_end)
+{
+    char* w = *buf;
+
+    while (p < end) {
+        while (p < end && IS_BLANK(*p)) p++;
+        if (p == end) {
+            break;
+        }
+        if (*argc + 1 >= max) {
+            return E2BIG;
+        }
+        argv[(*argc)++] = w;
+        while (p < end && !IS_BLANK(*p)) {
+            if (*p == '\"' || *p == '\'') {
+                char q = *p++;
+                while (p < end && *p != q) {
+                    if (w == buf_end) return E2BIG;
+                    *w++ = *p++;
+                }
+                if (p < end) p++;
+            }
+            else {
+                if (w == buf_end) return E2BIG;
+                *w++ = *p++;
+            }
+        }
+        if (w == buf_end) {
+            return E2BIG;
+        }
+        *w++ = '\0';
+    }
+    argv[*argc] = NULL;
+    *buf = w;
+    return ENOERR;
+}
+
+/* child side of a command, never returns */
+static void shell_jobs_child(char* const argv[], enum shell_redir r, const char* target, int in)
+{
+    if (in >= 0) {
+        dup2(in, STDIN_FILENO);
+    }
+    if (r != SOP_REDIR_NONE) {
+        int flags = (r == SOP_REDIR_IN) ? O_RDONLY
+                  : (r == SOP_REDIR_INOUT) ? O_RDWR | O_CREAT
+                  : (r == SOP_REDIR_OUT_APPEND) ? O_WRONLY | O_CREAT | O_APPEND
+                  : O_WRONLY | O_CREAT | O_TRUNC;
+        int fd = open(target, flags, 0666);
+
+        if (fd < 0) {
+            _exit(1);
+        }
+        dup2(fd, (r == SOP_REDIR_IN || r == SOP_REDIR_INOUT) ? STDIN_FILENO : STDOUT_FILENO);
+        close(fd);
+    }
+    execvp(argv[0], argv);
+    _exit(errno == ENOENT ? 127 : 126);
+}
+
+/* run one simple command, in the background or until it exits */
+static int shell_jobs_exec(struct shell_jobs* js,
+    const char* cmdb, const char* cmde, const char* paramsb, const char* paramse,
+    enum shell_redir r, const char* redirb, const char* redire,
+    const struct shell_heredoc* hd, int background, int* status)
+{
+    char buf[SHELL_JOBS_ARGBUF];
+    char* argv[SHELL_JOBS_MAX_ARGS];
+    char* target[2] = { NULL, NULL };
+    char* bp = buf;
+    size_t argc = 0, ntarget = 0;
+    int in = -1, pidfd = -1;
+    int rc;
+    pid_t pid;
+
+    rc = shell_jobs_words(cmdb, cmde, argv, &argc, SHELL_JOBS_MAX_ARGS, &bp, buf + sizeof(buf));
+    if (rc == ENOERR && paramsb) {
+        rc = shell_jobs_words(paramsb, paramse, argv, &argc, SHELL_JOBS_MAX_ARGS, &bp, buf + sizeof(buf));
+    }
+    if (rc == ENOERR && r != SOP_REDIR_NONE) {
+        rc = shell_jobs_words(redirb, redire, target, &ntarget, 2, &bp, buf + sizeof(buf));
+        if (rc == ENOERR && ntarget != 1) {
+            rc = EINVAL;
+        }
+    }
+    if (rc != ENOERR) {
+        return rc;
+    }
+
+    if (hd->delim_begin) {   /* the body is the standard input, unexpanded */
+        in = memfd_create("heredoc", MFD_CLOEXEC);
+        if (in < 0 || shell_heredoc_write(hd, in) < 0 || lseek(in, 0, SEEK_SET) < 0) {
+            rc = errno;
+            if (in >= 0) close(in);
+            return rc;
+        }
+    }
+
+    if (background) {
+        rc = shell_jobs_slot(js);
+    }
+    pid = (rc == ENOERR) ? shell_jobs_fork(js, &pidfd) : -1;
+    if (pid == 0) {
+        shell_jobs_child(argv, r, target[0], in);
+    }
+    if (pid < 0 && rc == ENOERR) {
+        rc = errno;
+    }
+    if (in >= 0) {
+        close(in);
+    }
+    if (rc != ENOERR) {
+        return rc;
+    }
+
+    if (background) {
+        js->jobs[js->running++] = pidfd;
+        *status = 0;
+        return ENOERR;
+    }
+
+    js->fg = pidfd;
+    while (js->fg >= 0 && rc == ENOERR) {
+        rc = shell_jobs_reap(js);
+    }
+    *status = js->fg_status;
+    return rc;
+}
+
+/* run the and-or list [begin, end) in a child as one background job, end
+   being just past its '&' */
+static int shell_jobs_subshell(struct shell_jobs* js, const char* begin, const char* end)
+{
+    const char* amp = end;
+    int rc = shell_jobs_slot(js);
+    int pidfd;
+    pid_t pid;
+
+    while (amp > begin && *--amp != '&');
+    if (rc != ENOERR) {
+        return rc;
+    }
+
+    pid = shell_jobs_fork(js, &pidfd);
+    if (pid < 0) {
+        return errno;
+    }
+    if (pid == 0) {
+        struct shell_jobs sub;
+        int slot;
+        char* list = strndup(begin, amp - begin);
+        int st = 1;
+
+        shell_jobs_free(js);   /* the parent's pidfds, not waited for here */
+        if (list && ENOERR == shell_jobs_init(&sub, &slot, 1)) {
+            if (ENOERR != shell_jobs_run(&sub, list, &st)) {
+                st = 1;
+            }
+        }
+        _exit(st);
+    }
+
+    js->jobs[js->running++] = pidfd;
+    return ENOERR;
+}
+
+int shell_jobs_run(struct shell_jobs* js, const char* script, int* status)
+{
+    const char *cmdb, *cmde, *paramsb, *paramse, *redir_begin, *redir_end, *context;
+    const char* cp = script;
+    struct shell_heredoc hd;
+    enum shell_redir r;
+    enum shell_operator o, prev = SOP_NEXT;
+    int st = 0, rc = ENOERR;
+
+    memset(&hd, 0, sizeof(hd));
+    while (rc == ENOERR) {
+        if (prev != SOP_AND && prev != SOP_OR) {   /* and-or list ahead, is it backgrounded? */
+            struct shell_heredoc scan = hd;
+            const char* sp = cp;
+            int n = 0, heredoc = 0;
+
+            do {
+                o = shell_heredoc_split(sp, &cmdb, &cmde, &paramsb, &paramse, &r, &redir_begin, &redir_end,
+                    &scan, &context);
+                sp = context;
+                heredoc |= (scan.delim_begin != NULL);
+                n++;
+            } while (o == SOP_AND || o == SOP_OR);
+
+            if (o == SOP_BG && n > 1) {
+                if (heredoc) {
+                    rc = ENOTSUP;
+                    break;
+                }
+                rc = shell_jobs_subshell(js, cp, context);
+                hd = scan;
+                cp = context;
+                prev = SOP_BG;
+                st = 0;
+                continue;
+            }
+        }
+
+        o = shell_heredoc_split(cp, &cmdb, &cmde, &paramsb, &paramse, &r, &redir_begin, &redir_end,
+            &hd, &context);
+        cp = context;
+        if (o == SOP_PIPE) {
+            rc = ENOTSUP;
+            break;
+        }
+
+        if (cmdb != cmde && !((prev == SOP_AND && st != 0) || (prev == SOP_OR && st == 0))) {
+            if (cmde - cmdb == 4 && 0 == strncmp(cmdb, "wait", 4)) {
+                rc = shell_jobs_wait(js);
+                st = 0;
+            }
+            else {
+                rc = shell_jobs_exec(js, cmdb, cmde, paramsb, paramse, r, redir_begin, redir_end,
+                    &hd, o == SOP_BG, &st);
+            }
+        }
+        prev = o;
+        if (o == SOP_NONE) {
+            break;
+        }
+    }
+
+    *status = st;
+    return rc;
+}
+
+#ifdef BUILD_TEST
+#include <stdio.h>
+
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+/* content of dir/name, "-" if it does not exist */
+static const char* slurp(const char* dir, const char* name, char* buf, size_t size)
+{
+    char path[PATH_MAX];
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return "-";
+    }
+    n = read(fd, buf, size - 1);
+    buf[n > 0 ? n : 0] = '\0';
+    close(fd);
+    unlink(path);
+    return buf;
+}
+
+static volatile sig_atomic_t sigchld_count;
+
+static void on_sigchld(int sig)
+{
+    (void)sig;
+    sigchld_count++;
+}
+
+int main(void)
+{
+    char dir[] = "/tmp/shell_jobs_XXXXXX";
+    char script[1024];
+    char buf[256];
+    int jobs[4];
+    struct shell_jobs js;
+    struct {
+        const char* script;     /* %s is the scratch directory */
+        const char* file;
+        const char* content;
+        int status;
+        int rc;
+    } t[] = {
+        { "echo one >> %s/a & echo two >> %s/a & wait",                  "a", NULL,          0, ENOERR },
+        { "false && echo no > %s/b ; true || echo no > %s/b ; false || echo yes > %s/b",
+                                                                        "b", "yes\n",       0, ENOERR },
+        { "true && echo 'x  y' > \"%s/c\" & wait",                      "c", "x  y\n",      0, ENOERR },
+        { "false && echo no > %s/d & wait",                             "d", "-",           0, ENOERR },
+        { "cat <<E > %s/e\nhello $x\nE\nsh -c 'exit 3'",                "e", "hello $x\n",  3, ENOERR },
+        { "tr a b < %s/f | cat",                                        "f", "-",           0, ENOTSUP },
+        { "/nonexistent/cmd",                                           "g", "-",           127, ENOERR },
+    };
+
+    if (NULL == mkdtemp(dir) || ENOERR != shell_jobs_init(&js, jobs, NELEMS(jobs))) {
+        return 1;
+    }
+
+    for (int i = 0; i < NELEMS(t); i++) {
+        int st = -1, rc;
+        const char* out;
+
+        snprintf(script, sizeof(script), t[i].script, dir, dir, dir);
+        rc = shell_jobs_run(&js, script, &st);
+        out = slurp(dir, t[i].file, buf, sizeof(buf));
+        printf("%s %d : %s", rc == t[i].rc && (rc != ENOERR || st == t[i].status)
+               && (t[i].content ? 0 == strcmp(out, t[i].content)
+                                : 0 == strcmp(out, "one\ntwo\n") || 0 == strcmp(out, "two\none\n")) ? "PASS" : "FAIL",
+               i, out);
+        printf("%s", out[strlen(out) - 1] == '\n' ? "" : "\n");
+    }
+
+    for (size_t max = 4; max >= 2; max -= 2) {
+        /* 4 jobs log their start and end, each waits for max jobs or all
+           4 started before ending. the most running at once is max */
+        struct shell_jobs lim;
+        char log[64];
+        int st, cur = 0, most = 0, lines = 0;
+        FILE* f;
+
+        snprintf(script, sizeof(script), "%s/job.sh", dir);
+        if (NULL != (f = fopen(script, "w"))) {
+            fprintf(f, "echo + >> %s/log\nn=0\nwhile [ $(grep -c + %s/log) -lt 4 ] "
+                    "&& [ $(( $(grep -c + %s/log) - $(grep -c -e - %s/log) )) -lt %zu ] && [ $n -lt 1000 ]; do\n"
+                    "    sleep 0.01; n=$((n+1))\ndone\necho - >> %s/log\n", dir, dir, dir, dir, max, dir);
+            fclose(f);
+        }
+        snprintf(script, sizeof(script), "sh %s/job.sh & sh %s/job.sh & sh %s/job.sh & sh %s/job.sh & wait",
+                 dir, dir, dir, dir);
+        shell_jobs_init(&lim, jobs, max);
+        shell_jobs_run(&lim, script, &st);
+        slurp(dir, "log", log, sizeof(log));
+        slurp(dir, "job.sh", buf, sizeof(buf));
+        for (const char* p = log; *p; p++) {
+            if (*p == '+' || *p == '-') {
+                cur += (*p == '+') ? 1 : -1;
+                most = (cur > most) ? cur : most;
+                lines++;
+            }
+        }
+        printf("%s %zu jobs at once : %d\n", most == (int)max && lines == 8 && lim.running == 0 ? "PASS" : "FAIL",
+               max, most);
+        shell_jobs_free(&lim);
+    }
+
+    {   /* a child started by the caller is left to it */
+        pid_t own = fork();
+        int st = -1, ost = -1;
+
+        if (own == 0) {
+            usleep(100000);
+            _exit(7);
+        }
+        shell_jobs_run(&js, "sleep 0.3 & wait", &st);
+        printf("%s foreign child\n", own > 0 && waitpid(own, &ost, 0) == own && WEXITSTATUS(ost) == 7 ? "PASS" : "FAIL");
+    }
+
+    {   /* the SIGCHLD handler of the caller still runs */
+        struct sigaction sa, old;
+        int st = -1, rc;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_sigchld;
+        sigaction(SIGCHLD, &sa, &old);
+        rc = shell_jobs_run(&js, "sleep 0.1 & sh -c 'exit 5'", &st);
+        rc = (rc == ENOERR) ? shell_jobs_run(&js, "wait", &st) : rc;
+        sigaction(SIGCHLD, &old, NULL);
+        printf("%s caller SIGCHLD handler : %d\n", rc == ENOERR && sigchld_count > 0 && st == 0 && js.running == 0 ? "PASS" : "FAIL",
+               (int)sigchld_count);
+    }
+
+    {
+        int st, rc;
+
+        js.failed = 0;
+        rc = shell_jobs_run(&js, "false & false & true & sh -c 'exit 2' & wait", &st);
+        printf("%s failed jobs : %zu\n", rc == ENOERR && js.failed == 3 && js.running == 0 ? "PASS" : "FAIL", js.failed);
+    }
+
+    shell_jobs_free(&js);
+    rmdir(dir);
+    return 0;
+}
+#endif
@@ -5,8 +5,18 @@
   DESCRIPTION: utility to extract ash compatible tokens.
   <command>[params][operators]
 
+  Other modules include this file with SHELL_TOKEN_LIB defined, which
+  leaves out the test and benchmark mains. SHELL_TOKEN_API prefixes the
+  public functions, a header only user defines it as static inline.
+
 ****************************************************************************/
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#ifndef SHELL_TOKEN_API
+#define SHELL_TOKEN_API
+#endif
 
 /* Redirection operators */
 enum shell_redir {
@@ -15,6 +25,8 @@ enum shell_redir {
     SOP_REDIR_OUT,          /* > */
     SOP_REDIR_IN,           /* < */
     SOP_REDIR_INOUT,        /* <> */
+    SOP_REDIR_HEREDOC,      /* << */
+    SOP_REDIR_HEREDOC_STRIP,/* <<- */
 };
 
 /* Control operators */
@@ -24,7 +36,7 @@ enum shell_operator {
     SOP_OR,                 /* logical || */
     SOP_BG,                 /* background */
     SOP_PIPE,               /* | */
-    SOP_NEXT,               /* ; */
+    SOP_NEXT,               /* ; or newline */
 };
 
 /**
@@ -38,9 +50,9 @@ enum shell_operator {
  *  Token separator is
  *  - blanks : spaces and tabs
  *  - control operators
- *  {'&', '|', '&&', '||', ';'}
+ *  {'&', '|', '&&', '||', ';', newline}
  *  - redirection operators
- *  {'>', '>>', '<', '<>'}
+ *  {'>', '>>', '<', '<>', '<<', '<<-'}
  * 
  *  Quoting makes an exception to the token separator. Matching
  *  double quotes or single quotes
@@ -72,21 +84,451 @@ enum shell_operator {
  * 
  * @return enum shell_operator 
  */
-enum shell_operator shell_command_param_split(const char* input,
+SHELL_TOKEN_API enum shell_operator shell_command_param_split(const char* input,
     const char** cmd_begin, const char** cmd_end,
     const char** params_begin, const char** params_end,
     enum shell_redir* sop_redir, const char** redir_begin, const char** redir_end,
     const char** context);
 
+/* Compound commands */
+enum shell_group {
+    SOP_GROUP_NONE,         /* simple command */
+    SOP_GROUP_SUBSHELL,     /* ( list ) */
+    SOP_GROUP_BRACE,        /* { list; } */
+};
+
+#define SHELL_GROUP_NOMATCH UINT32_MAX
+
+/* partner offsets of the grouping delimiters in a script */
+struct shell_group_index {
+    const char* script;
+    size_t len;
+    uint32_t* match;        /* len entries, SHELL_GROUP_NOMATCH if not a matched delimiter */
+};
+
+/**
+ * Build the match index for ( ) subshells, $( ) substitutions and { } brace
+ * groups of a script in one linear pass. Quoted delimiters and here-document
+ * bodies are ignored, '{' and '}' are recognized only as reserved words in
+ * command position.
+ *
+ * The pending open delimiters are threaded through the match array itself,
+ * so no memory other than the caller supplied array is needed.
+ *
+ * @param idx : index to initialize
+ * @param script : script text, need not be nul terminated
+ * @param len : length of the script
+ * @param match : array of len entries
+ * @param unmatched : number of unmatched delimiters, 0 if the script is balanced
+ *
+ * @return 0 on success, EOVERFLOW if len does not fit 32 bits or a line
+ *         starts more than SHELL_HEREDOC_PER_LINE here-documents. The index
+ *         is not usable after an error
+ */
+SHELL_TOKEN_API int shell_group_index_build(struct shell_group_index* idx, const char* script, size_t len,
+    uint32_t* match, size_t* unmatched);
+
+/**
+ * Split the next command of a script that may contain subshells and brace
+ * groups. A group is returned as a single command whose cmd_begin/cmd_end
+ * delimit the list inside the group, the caller splits that list by
+ * calling again with input = cmd_begin and end = cmd_end. The closing
+ * delimiter is found through the index, so the group body is not scanned
+ * here. Simple commands are split by shell_command_param_split.
+ *
+ *  USAGE:
+ *
+ *      o = shell_group_split(&idx, script, NULL, &g, &cmdb, &cmde, ...);
+ *      if (g != SOP_GROUP_NONE) {
+ *          // recurse on [cmdb, cmde)
+ *      }
+ *
+ * @param idx : match index of the script holding input
+ * @param input : input string, NULL to continue from context
+ * @param end : end of the enclosing group list, NULL at top level
+ * @param group : kind of the command
+ * @param cmd_begin, cmd_end : command, or the list inside the group
+ * @param params_begin, params_end : parameters of a simple command
+ * @param sop_redir, redir_begin, redir_end : redirection of the command or group
+ * @param context
+ *
+ * @return enum shell_operator
+ */
+SHELL_TOKEN_API enum shell_operator shell_group_split(const struct shell_group_index* idx,
+    const char* input, const char* end, enum shell_group* group,
+    const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end,
+    enum shell_redir* sop_redir, const char** redir_begin, const char** redir_end,
+    const char** context);
+
+/* Here-document of a command. The body is a slice of the input */
+struct shell_heredoc {
+    const char* delim_begin;    /* delimiter word as written, NULL if the command has none */
+    const char* delim_end;
+    const char* body_begin;     /* first body line */
+    const char* body_end;       /* start of the delimiter line */
+    int strip_tabs;             /* <<- : leading tabs are not part of the body lines */
+    int quoted;                 /* quoted delimiter : the body is not expanded */
+    const char* skip_from;      /* private : pending bodies of the current line */
+    const char* skip_to;
+};
+
+/**
+ * Split a command like shell_command_param_split and in addition parse
+ * here-documents (<<, <<- and quoted delimiters) of multi line scripts.
+ * The here-document is returned in heredoc and the regular redirection of
+ * the same command, as in `cat <<EOF > file`, in sop_redir. Once the
+ * newline ending the command line is consumed, context continues after
+ * the delimiter line, so bodies are never tokenized.
+ *
+ * heredoc carries state between calls, zero initialize it before the
+ * first call of a script.
+ *
+ * @return enum shell_operator
+ */
+SHELL_TOKEN_API enum shell_operator shell_heredoc_split(const char* input,
+    const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end,
+    enum shell_redir* sop_redir, const char** redir_begin, const char** redir_end,
+    struct shell_heredoc* heredoc, const char** context);
+
+/**
+ * Write a here-document body to fd straight from the input buffer. For <<-
+ * the lines are gathered past their leading tabs with writev.
+ *
+ * @return number of bytes written, -1 with errno set on failure
+ */
+SHELL_TOKEN_API ssize_t shell_heredoc_write(const struct shell_heredoc* hd, int fd);
+
+/**
+ * In process execution of `cat <<EOF > target`. Opens the redirection
+ * target and writes the body to it without copying the body.
+ *
+ * @param hd : here-document of the command
+ * @param sop_redir : SOP_REDIR_OUT or SOP_REDIR_OUT_APPEND
+ * @param target_begin, target_end : redirection target
+ *
+ * @return
+ *     0 on success
+ *     ENOTSUP if the body needs expansion by the shell
+ *     errno value of the failing call otherwise
+ */
+SHELL_TOKEN_API int shell_heredoc_redirect(const struct shell_heredoc* hd, enum shell_redir sop_redir,
+    const char* target_begin, const char* target_end);
+
+/* Token classes of a command line, as needed by a line editor */
+enum shell_tok_kind {
+    SHELL_TOK_CMD,      /* first word of a simple command */
+    SHELL_TOK_WORD,     /* parameter */
+    SHELL_TOK_REDIR,    /* > >> < <> << <<- */
+    SHELL_TOK_TARGET,   /* word following a redirection */
+    SHELL_TOK_OPER,     /* && || & | ; newline */
+    SHELL_TOK_GROUP,    /* ( ) */
+};
+
+struct shell_tok {
+    uint32_t begin;     /* offset in the line */
+    uint32_t len;
+    uint8_t kind;       /* enum shell_tok_kind */
+    uint8_t state;      /* lexer state at begin */
+};
+
+/*
+ * Token list of an edited line. The tokens live in a caller supplied array
+ * with a gap at the last edit position : tokens before the gap keep their
+ * offset from the line start, tokens after it their offset from the line
+ * end, so an edit never has to shift the tokens behind the cursor.
+ */
+struct shell_lexline {
+    struct shell_tok* tok;
+    size_t cap;
+    size_t gap_lo;      /* tok[0, gap_lo) : before the gap */
+    size_t gap_hi;      /* tok[gap_hi, cap) : after the gap */
+    size_t len;         /* line length */
+};
+
+/**
+ * Initialize ll on top of the token array tok of cap elements.
+ */
+SHELL_TOKEN_API void shell_lexline_init(struct shell_lexline* ll, struct shell_tok* tok, size_t cap);
+
+/**
+ * Tokenize the whole NUL terminated line.
+ *
+ * @return 0 on success, ENOSPC if the line has more than cap tokens
+ */
+SHELL_TOKEN_API int shell_lexline_parse(struct shell_lexline* ll, const char* line);
+
+/**
+ * Update the token list after an edit of the line. The edit replaced
+ * `removed` bytes at pos by `inserted` bytes, line is the NUL terminated
+ * text after the edit. Its length follows from the edit, the line is not
+ * measured. Only the token before pos is re-lexed, onwards until a token
+ * lines up with an old token of the same lexer state; past that point the
+ * old tokens are kept as is. Typing or deleting one character re-lexes one
+ * or two tokens whatever the line length.
+ *
+ * @param rescanned : if not NULL, number of tokens re-lexed
+ *
+ * @return
+ *     0 on success
+ *     EINVAL if the edit falls outside the previous line or the line
+ *     would exceed UINT32_MAX bytes
+ *     ENOSPC if the line has more than cap tokens, the list is truncated
+ */
+SHELL_TOKEN_API int shell_lexline_edit(struct shell_lexline* ll, const char* line,
+    size_t pos, size_t removed, size_t inserted, size_t* rescanned);
+
+/**
+ * @return number of tokens of the line
+ */
+SHELL_TOKEN_API size_t shell_lexline_count(const struct shell_lexline* ll);
+
+/**
+ * @return token i of the line, begin being its offset from the line start
+ */
+SHELL_TOKEN_API struct shell_tok shell_lexline_token(const struct shell_lexline* ll, size_t i);
+
 /* IMPLEMENTATION */
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
 
-#define EAT_BLANK(p) while (p && (*p == ' ' || *p == '\t')) p++;
+#define IS_BLANK(c) ((c) == ' ' || (c) == '\t')
+#define IS_SEPER(c) (IS_BLANK(c) || (c) == '>' || (c) == '<' || (c) == '|' || (c) == '&' || (c) == ';' || (c) == '(' || (c) == ')' || (c) == '\n')
+#define SHELL_HEREDOC_IOV 64        /* lines gathered per writev */
+#define SHELL_HEREDOC_PER_LINE 4    /* here-documents tracked per line by the group index */
+#define EAT_BLANK(p) while (p && IS_BLANK(*p)) p++;
 #define GET_CHAR(p, c) while (p && *p && *p != c) p++;
-#define GET_SEPER(p) while (p && *p && *p != ' ' && *p != '\t' && *p != '>' && *p != '<' && *p != '|' && *p != '&' && *p != ';') { if (*p == '\"') { p++; GET_CHAR(p, '\"'); if (*p) p++; } else p++; }
+#define GET_SEPER(p) p = shell_seek_seper(p);
+
+/* seek past the ')' closing a $( substitution, p is just after the '(' */
+static const char* shell_seek_subst(const char* p)
+{
+    uint32_t num = 1;
+
+    while (*p) {
+        if (*p == '\"' || *p == '\'') {
+            char q = *p++;
+            GET_CHAR(p, q);
+            if (*p) p++;
+            continue;
+        }
+        if (*p == '(') {
+            num++;
+        }
+        else if (*p == ')' && 0 == --num) {
+            return p + 1;
+        }
+        p++;
+    }
+    return p;
+}
 
-enum shell_operator shell_command_param_split(const char* input, const char** cmd_begin, const char** cmd_end,
+/* seek to the end of a word. quoted strings and $( .. ) substitutions are
+   part of the word, even when they contain token separators */
+static inline const char* shell_seek_seper(const char* p)
+{
+    while (*p && !IS_SEPER(*p)) {
+        if (*p == '\"' || *p == '\'') {
+            char q = *p++;
+            GET_CHAR(p, q);
+            if (*p) p++;
+        }
+        else if (*p == '$' && p[1] == '(') {
+            p = shell_seek_subst(p + 2);
+        }
+        else {
+            p++;
+        }
+    }
+    return p;
+}
+
+/* does the line at p consist of the here-document delimiter only? returns
+   the end of the line if so. quote characters of the delimiter word are
+   not part of the delimiter */
+static const char* shell_heredoc_delim_line(const char* p, const char* end,
+    const char* delim_begin, const char* delim_end, int strip_tabs)
+{
+    if (strip_tabs) {
+        while (p != end && *p == '\t') p++;
+    }
+    for (const char* d = delim_begin; d < delim_end; d++) {
+        if (*d == '\"' || *d == '\'' || *d == '\\') {
+            continue;
+        }
+        if (p == end || *p != *d) {
+            return NULL;
+        }
+        p++;
+    }
+    return (p == end || *p == '\0' || *p == '\n') ? p : NULL;
+}
+
+/* find the end of a here-document body that starts at line. end bounds the
+   input, NULL for a nul terminated input. *resume is set to the line after
+   the delimiter line */
+static const char* shell_heredoc_body_end(const char* line, const char* end,
+    const char* delim_begin, const char* delim_end, int strip_tabs, const char** resume)
+{
+    const char* p = line;
+
+    for (;;) {
+        const char* e = shell_heredoc_delim_line(p, end, delim_begin, delim_end, strip_tabs);
+        if (e) {
+            *resume = (e != end && *e == '\n') ? e + 1 : e;
+            return p;
+        }
+        while (p != end && *p && *p != '\n') p++;
+        if (p == end || !*p) {   /* unterminated, the body runs to the end of input */
+            *resume = p;
+            return p;
+        }
+        p++;
+    }
+}
+
+/* record the here-document whose delimiter word is [wb, we). The body
+   starts on the line following cp, or after the body of an earlier
+   here-document of the same line */
+static void shell_heredoc_locate(struct shell_heredoc* hd, enum shell_redir kind,
+    const char* wb, const char* we, const char* cp)
+{
+    const char* line = hd->skip_to;
+
+    if (NULL == line) {
+        while (*cp && *cp != '\n') cp++;
+        line = *cp ? cp + 1 : cp;
+        hd->skip_from = line;
+    }
+
+    hd->delim_begin = wb;
+    hd->delim_end = we;
+    hd->strip_tabs = (kind == SOP_REDIR_HEREDOC_STRIP);
+    hd->quoted = 0;
+    for (const char* d = wb; d < we; d++) {
+        if (*d == '\"' || *d == '\'' || *d == '\\') {
+            hd->quoted = 1;
+        }
+    }
+    hd->body_begin = line;
+    hd->body_end = shell_heredoc_body_end(line, NULL, wb, we, hd->strip_tabs, &hd->skip_to);
+}
+
+/* parse the redirections and the control operator that terminate a
+   command, cp points just past the command words. Without a here-document
+   record a single redirection is parsed, here-documents included */
+static enum shell_operator shell_redir_oper_split(const char* cp, enum shell_redir* sop_redir,
+    const char** redir_begin, const char** redir_end, struct shell_heredoc* hd, const char** context)
+{
+    enum shell_operator o;
+
+    for (;;) {
+        enum shell_redir kind;
+        const char* wb = NULL;
+        const char* we = NULL;
+
+        switch (*cp) {
+        case '>':
+            kind = SOP_REDIR_OUT;
+            cp++;
+            if (cp && *cp && *cp == '>') {
+                kind = SOP_REDIR_OUT_APPEND;
+                cp++;
+            }
+            break;
+        case '<':
+            kind = SOP_REDIR_IN;
+            cp++;
+            if (cp && *cp && *cp == '>') {
+                kind = SOP_REDIR_INOUT;
+                cp++;
+            }
+            else if (cp && *cp && *cp == '<') {
+                kind = SOP_REDIR_HEREDOC;
+                cp++;
+                if (*cp == '-') {
+                    kind = SOP_REDIR_HEREDOC_STRIP;
+                    cp++;
+                }
+            }
+            break;
+        default:
+            kind = SOP_REDIR_NONE;
+        }
+
+        if (kind == SOP_REDIR_NONE) {
+            break;
+        }
+
+        if (*cp) {
+            EAT_BLANK(cp);   /* seek */
+            wb = we = cp;
+            if (*cp) {
+                GET_SEPER(cp);
+                we = cp;
+                EAT_BLANK(cp);
+            }
+        }
+
+        if (hd && (kind == SOP_REDIR_HEREDOC || kind == SOP_REDIR_HEREDOC_STRIP)) {
+            shell_heredoc_locate(hd, kind, wb, we, cp);
+        }
+        else {
+            *sop_redir = kind;
+            *redir_begin = wb;
+            *redir_end = we;
+        }
+
+        if (NULL == hd || (*sop_redir != SOP_REDIR_NONE && hd->delim_begin)) {
+            break;   /* one of each kind */
+        }
+    }
+
+    switch (*cp) {
+    case '&':
+        o = SOP_BG;
+        cp++;
+        if (cp && *cp && *cp == '&') {
+            o = SOP_AND;
+            cp++;
+        }
+        break;
+    case '|':
+        o = SOP_PIPE;
+        cp++;
+        if (cp && *cp && *cp == '|') {
+            o = SOP_OR;
+            cp++;
+        }
+        break;
+    case ';':
+        o = SOP_NEXT;
+        cp++;
+        break;
+    case '\n':
+        o = SOP_NEXT;
+        cp++;
+        if (hd && hd->skip_from == cp) {   /* jump over the here-document bodies of this line */
+            cp = hd->skip_to;
+            hd->skip_from = hd->skip_to = NULL;
+        }
+        break;
+    default:
+        o = SOP_NONE;
+    }
+
+    *context = cp;
+    return o;
+}
+
+static enum shell_operator shell_split(const char* input, const char** cmd_begin, const char** cmd_end,
     const char** params_begin, const char** params_end, enum shell_redir* sop_redir, const char** redir_begin,
-    const char** redir_end, const char** context)
+    const char** redir_end, struct shell_heredoc* hd, const char** context)
 {
     enum shell_operator o = SOP_NONE;
     const char* cp = (input != NULL) ? input : *context;
@@ -98,90 +540,542 @@ enum shell_operator shell_command_param_split(const char* input, const char** cm
     *sop_redir = SOP_REDIR_NONE;
     *redir_begin = NULL;
     *redir_end = NULL;
+    if (hd) {
+        hd->delim_begin = hd->delim_end = NULL;
+        hd->body_begin = hd->body_end = NULL;
+        hd->strip_tabs = hd->quoted = 0;
+    }
 
     EAT_BLANK(cp);   /* seek command */
     *cmd_end = *cmd_begin = cp; /* initialize command begin and end here */
     if (*cp) {
         GET_SEPER(cp);  /* seek to end of command */
         *cmd_end = cp;
-        if (*cp && *cp == ' ') {
+        if (IS_BLANK(*cp)) {
             EAT_BLANK(cp);   /* seek parameter */
             *params_end = *params_begin = cp;
             if (*cp) {
                 GET_SEPER(cp);
                 *params_end = cp;
-                while (*cp && *cp == ' ') {
+                while (IS_BLANK(*cp)) {
+                    const char* wp;
                     EAT_BLANK(cp);   /* seek next */
+                    wp = cp;
                     GET_SEPER(cp);
-                    if (*cp && *cp == ' ') {
+                    if (cp != wp) {  /* extend over the word just read */
                         *params_end = cp;
                     }
                 }
             }
         }
-        switch (*cp) {
-        case '>':
-            *sop_redir = SOP_REDIR_OUT;
-            cp++;
-            if (cp && *cp && *cp == '>') {
-                *sop_redir = SOP_REDIR_OUT_APPEND;
-                cp++;
+        return shell_redir_oper_split(cp, sop_redir, redir_begin, redir_end, hd, context);
+    }
+
+    *context = cp;
+
+    return o;
+}
+
+SHELL_TOKEN_API enum shell_operator shell_command_param_split(const char* input, const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end, enum shell_redir* sop_redir, const char** redir_begin,
+    const char** redir_end, const char** context)
+{
+    return shell_split(input, cmd_begin, cmd_end, params_begin, params_end, sop_redir,
+        redir_begin, redir_end, NULL, context);
+}
+
+SHELL_TOKEN_API enum shell_operator shell_heredoc_split(const char* input, const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end, enum shell_redir* sop_redir, const char** redir_begin,
+    const char** redir_end, struct shell_heredoc* heredoc, const char** context)
+{
+    return shell_split(input, cmd_begin, cmd_end, params_begin, params_end, sop_redir,
+        redir_begin, redir_end, heredoc, context);
+}
+
+SHELL_TOKEN_API ssize_t shell_heredoc_write(const struct shell_heredoc* hd, int fd)
+{
+    const char* p = hd->body_begin;
+    ssize_t total = 0;
+
+    if (!hd->strip_tabs) {
+        while (p < hd->body_end) {
+            ssize_t n = write(fd, p, hd->body_end - p);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            p += n;
+            total += n;
+        }
+        return total;
+    }
+
+    /* <<- : gather the lines past their leading tabs, the body is never copied */
+    while (p < hd->body_end) {
+        struct iovec iov[SHELL_HEREDOC_IOV];
+        int cnt = 0;
+        ssize_t n;
+
+        while (p < hd->body_end && cnt < SHELL_HEREDOC_IOV) {
+            const char* e;
+            while (p < hd->body_end && *p == '\t') p++;
+            e = p;
+            while (e < hd->body_end && *e++ != '\n');
+            if (e > p) {
+                iov[cnt].iov_base = (void*)p;
+                iov[cnt].iov_len = e - p;
+                cnt++;
+            }
+            p = e;
+        }
+
+        for (int i = 0; i < cnt; ) {
+            n = writev(fd, iov + i, cnt - i);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                return -1;
+            }
+            total += n;
+            while (i < cnt && (size_t)n >= iov[i].iov_len) {   /* short write, resume mid vector */
+                n -= iov[i].iov_len;
+                i++;
+            }
+            if (i < cnt) {
+                iov[i].iov_base = (char*)iov[i].iov_base + n;
+                iov[i].iov_len -= n;
+            }
+        }
+    }
+    return total;
+}
+
+SHELL_TOKEN_API int shell_heredoc_redirect(const struct shell_heredoc* hd, enum shell_redir sop_redir,
+    const char* target_begin, const char* target_end)
+{
+    char path[PATH_MAX];
+    size_t n = 0;
+    int flags, fd, rc = 0;
+
+    if (!hd->quoted) {   /* parameter expansion and command substitution need the shell */
+        for (const char* p = hd->body_begin; p < hd->body_end; p++) {
+            if (*p == '$' || *p == '`' || *p == '\\') {
+                return ENOTSUP;
+            }
+        }
+    }
+
+    switch (sop_redir) {
+    case SOP_REDIR_OUT:
+        flags = O_WRONLY | O_CREAT | O_TRUNC;
+        break;
+    case SOP_REDIR_OUT_APPEND:
+        flags = O_WRONLY | O_CREAT | O_APPEND;
+        break;
+    default:
+        return EINVAL;
+    }
+
+    for (const char* p = target_begin; p < target_end; p++) {   /* unquote the path */
+        if (*p == '\"' || *p == '\'') {
+            continue;
+        }
+        if (n + 1 >= sizeof(path)) {
+            return ENAMETOOLONG;
+        }
+        path[n++] = *p;
+    }
+    if (0 == n) {
+        return EINVAL;
+    }
+    path[n] = '\0';
+
+    fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        return errno;
+    }
+    if (shell_heredoc_write(hd, fd) < 0) {
+        rc = errno;
+    }
+    if (close(fd) < 0 && 0 == rc) {
+        rc = errno;
+    }
+    return rc;
+}
+
+SHELL_TOKEN_API int shell_group_index_build(struct shell_group_index* idx, const char* script, size_t len,
+    uint32_t* match, size_t* unmatched)
+{
+    uint32_t top = SHELL_GROUP_NOMATCH;   /* innermost pending open delimiter */
+    int cmdpos = 1;                       /* next word is in command position */
+    char quote = '\0';
+    struct {
+        const char* delim_begin;
+        const char* delim_end;
+        int strip_tabs;
+    } heredoc[SHELL_HEREDOC_PER_LINE];    /* here-documents whose bodies follow this line */
+    int nheredoc = 0;
+
+    if (len > UINT32_MAX) {   /* offsets are 32 bits */
+        return EOVERFLOW;
+    }
+    idx->script = script;
+    idx->len = len;
+    idx->match = match;
+    *unmatched = 0;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = script[i];
+
+        match[i] = SHELL_GROUP_NOMATCH;
+        if (quote) {
+            if (c == quote) {
+                quote = '\0';
             }
+            continue;
+        }
+
+        switch (c) {
+        case '\"':
+        case '\'':
+            quote = c;
+            cmdpos = 0;
+            break;
+        case ' ':
+        case '\t':
+            break;
+        case '\n':
+            for (int k = 0; k < nheredoc; k++) {   /* bodies are not script text */
+                const char* resume;
+                shell_heredoc_body_end(script + i + 1, script + len, heredoc[k].delim_begin,
+                    heredoc[k].delim_end, heredoc[k].strip_tabs, &resume);
+                while (i + 1 < (size_t)(resume - script)) {
+                    match[++i] = SHELL_GROUP_NOMATCH;
+                }
+            }
+            nheredoc = 0;
+            cmdpos = 1;
+            break;
+        case ';':
+        case '&':
+        case '|':
+            cmdpos = 1;
             break;
         case '<':
-            *sop_redir = SOP_REDIR_IN;
-            cp++;
-            if (cp && *cp && *cp == '>') {
-                *sop_redir = SOP_REDIR_INOUT;
-                cp++;
+            if (i + 1 < len && script[i + 1] == '<') {
+                size_t w = i + 2;
+                int strip = (w < len && script[w] == '-');
+
+                if (nheredoc == SHELL_HEREDOC_PER_LINE) {   /* its body would be read as script */
+                    return EOVERFLOW;
+                }
+
+                for (w += strip; w < len && IS_BLANK(script[w]); w++);
+                heredoc[nheredoc].delim_begin = script + w;
+                while (w < len && !IS_SEPER(script[w])) {
+                    if (script[w] == '\"' || script[w] == '\'') {
+                        char q = script[w++];
+                        while (w < len && script[w] != q) w++;
+                    }
+                    if (w < len) w++;
+                }
+                heredoc[nheredoc].delim_end = script + w;
+                heredoc[nheredoc].strip_tabs = strip;
+                nheredoc++;
+                while (i + 1 < w) {   /* operator and delimiter word */
+                    match[++i] = SHELL_GROUP_NOMATCH;
+                }
             }
+            cmdpos = 0;
+            break;
+        case '(':
+            match[i] = top;          /* push */
+            top = (uint32_t)i;
+            cmdpos = 1;
+            break;
+        case '{':
+            if (cmdpos && (i + 1 == len || IS_BLANK(script[i + 1]) || script[i + 1] == '\n')) {
+                match[i] = top;
+                top = (uint32_t)i;
+            }
+            else {
+                cmdpos = 0;
+            }
+            break;
+        case ')':
+        case '}':
+            if (c == '}' && (!cmdpos || (i + 1 < len && !IS_SEPER(script[i + 1]) && script[i + 1] != '\n'))) {
+                cmdpos = 0;          /* plain word */
+                break;
+            }
+            if (top != SHELL_GROUP_NOMATCH && script[top] == (c == ')' ? '(' : '{')) {
+                uint32_t open = top;
+                top = match[open];   /* pop */
+                match[open] = (uint32_t)i;
+                match[i] = open;
+            }
+            else {
+                (*unmatched)++;
+            }
+            cmdpos = 0;
             break;
         default:
-            *sop_redir = SOP_REDIR_NONE;
+            cmdpos = 0;
         }
+    }
 
-        if (*sop_redir != SOP_REDIR_NONE && *cp) {
-            EAT_BLANK(cp);   /* seek */
-            *redir_end = *redir_begin = cp;
-            if (*cp) {
-                GET_SEPER(cp);
-                *redir_end = cp;
-                EAT_BLANK(cp);
-            }
-        }
+    while (top != SHELL_GROUP_NOMATCH) {   /* unclosed groups */
+        uint32_t open = top;
+        top = match[open];
+        match[open] = SHELL_GROUP_NOMATCH;
+        (*unmatched)++;
+    }
+
+    return 0;
+}
+
+/* cut the span [*b, *e) at end, then drop the blanks and newlines left
+   at its end. a span starting at or past end becomes empty */
+static void shell_group_clip(const char** b, const char** e, const char* end, int keep)
+{
+    if (*b == NULL || *e <= end) {
+        return;
+    }
+    if (*b >= end) {
+        *b = *e = keep ? end : NULL;
+        return;
+    }
+    for (*e = end; *e > *b && (IS_BLANK((*e)[-1]) || (*e)[-1] == '\n'); (*e)--);
+}
+
+SHELL_TOKEN_API enum shell_operator shell_group_split(const struct shell_group_index* idx,
+    const char* input, const char* end, enum shell_group* group,
+    const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end,
+    enum shell_redir* sop_redir, const char** redir_begin, const char** redir_end,
+    const char** context)
+{
+    const char* cp = (input != NULL) ? input : *context;
+    uint32_t close = SHELL_GROUP_NOMATCH;
+
+    *group = SOP_GROUP_NONE;
+    EAT_BLANK(cp);
+    if (cp == end) {   /* end of the group list */
+        *cmd_begin = *cmd_end = cp;
+        *params_begin = *params_end = NULL;
+        *sop_redir = SOP_REDIR_NONE;
+        *redir_begin = *redir_end = NULL;
+        *context = cp;
+        return SOP_NONE;
+    }
+
+    if ((*cp == '(' || *cp == '{') && cp >= idx->script && cp < idx->script + idx->len) {
+        close = idx->match[cp - idx->script];
+    }
 
-        switch (*cp) {
-        case '&':
-            o = SOP_BG;
-            cp++;
-            if (cp && *cp && *cp == '&') {
-                o = SOP_AND;
-                cp++;
-            }
-            break;
-        case '|':
-            o = SOP_PIPE;
-            cp++;
-            if (cp && *cp && *cp == '|') {
-                o = SOP_OR;
-                cp++;
+    if (close == SHELL_GROUP_NOMATCH) {
+        enum shell_operator o = shell_command_param_split(cp, cmd_begin, cmd_end, params_begin, params_end,
+            sop_redir, redir_begin, redir_end, context);
+
+        if (end && *context > end) {   /* the split knows no end, keep it in the group */
+            shell_group_clip(cmd_begin, cmd_end, end, 1);
+            shell_group_clip(params_begin, params_end, end, 0);
+            shell_group_clip(redir_begin, redir_end, end, 0);
+            if (*redir_begin == NULL) {
+                *sop_redir = SOP_REDIR_NONE;
             }
-            break;
-        case ';':
-            o = SOP_NEXT;
-            cp++;
-            break;
-        default:
+            *context = end;
             o = SOP_NONE;
         }
+        return o;
     }
 
-    *context = cp;
+    *group = (*cp == '(') ? SOP_GROUP_SUBSHELL : SOP_GROUP_BRACE;
+    *cmd_begin = cp + 1;
+    *cmd_end = idx->script + close;
+    *params_begin = *params_end = NULL;
+    *sop_redir = SOP_REDIR_NONE;
+    *redir_begin = *redir_end = NULL;
 
-    return o;
+    cp = *cmd_end + 1;   /* jump over the group */
+    EAT_BLANK(cp);
+    return shell_redir_oper_split(cp, sop_redir, redir_begin, redir_end, NULL, context);
+}
+
+#define SHELL_LEX_ARGS    0x01   /* the command word of the simple command is seen */
+#define SHELL_LEX_TARGET  0x02   /* next word is a redirection target */
+
+/* lex the token at or after p. the token only depends on the text from p
+   on and on *state, which is what makes re-synchronization sound */
+static const char* shell_lex_next(const char* line, const char* p, uint8_t* state, struct shell_tok* t)
+{
+    EAT_BLANK(p);
+    if (!*p) {
+        return NULL;
+    }
+
+    t->begin = (uint32_t)(p - line);
+    t->state = *state;
+    switch (*p) {
+    case '>':
+    case '<':
+        if ((p[1] == '>' || (*p == '<' && p[1] == '<'))) {
+            p += (*p == '<' && p[1] == '<' && p[2] == '-') ? 3 : 2;
+        }
+        else {
+            p++;
+        }
+        t->kind = SHELL_TOK_REDIR;
+        *state |= SHELL_LEX_TARGET;
+        break;
+    case '&':
+    case '|':
+        p += (p[1] == *p) ? 2 : 1;
+        t->kind = SHELL_TOK_OPER;
+        *state = 0;
+        break;
+    case ';':
+    case '\n':
+        p++;
+        t->kind = SHELL_TOK_OPER;
+        *state = 0;
+        break;
+    case '(':
+    case ')':
+        t->kind = SHELL_TOK_GROUP;
+        *state = (*p == '(') ? 0 : SHELL_LEX_ARGS;
+        p++;
+        break;
+    default:
+        GET_SEPER(p);
+        if (*state & SHELL_LEX_TARGET) {
+            t->kind = SHELL_TOK_TARGET;
+            *state &= ~SHELL_LEX_TARGET;
+        }
+        else if (!(*state & SHELL_LEX_ARGS)) {
+            t->kind = SHELL_TOK_CMD;
+            *state |= SHELL_LEX_ARGS;
+        }
+        else {
+            t->kind = SHELL_TOK_WORD;
+        }
+    }
+    t->len = (uint32_t)(p - line) - t->begin;
+
+    return p;
+}
+
+/* move the gap to k tokens before it, offsets are converted on the way */
+static void shell_lexline_move_gap(struct shell_lexline* ll, size_t k)
+{
+    while (ll->gap_lo > k) {
+        struct shell_tok* t = &ll->tok[--ll->gap_hi];
+
+        *t = ll->tok[--ll->gap_lo];
+        t->begin = (uint32_t)(ll->len - t->begin);
+    }
+    while (ll->gap_lo < k) {
+        struct shell_tok* t = &ll->tok[ll->gap_lo++];
+
+        *t = ll->tok[ll->gap_hi++];
+        t->begin = (uint32_t)(ll->len - t->begin);
+    }
+}
+
+SHELL_TOKEN_API void shell_lexline_init(struct shell_lexline* ll, struct shell_tok* tok, size_t cap)
+{
+    ll->tok = tok;
+    ll->cap = cap;
+    ll->gap_lo = 0;
+    ll->gap_hi = cap;
+    ll->len = 0;
+}
+
+SHELL_TOKEN_API int shell_lexline_parse(struct shell_lexline* ll, const char* line)
+{
+    ll->gap_lo = 0;
+    ll->gap_hi = ll->cap;
+    ll->len = 0;
+    return shell_lexline_edit(ll, line, 0, 0, strlen(line), NULL);
+}
+
+SHELL_TOKEN_API int shell_lexline_edit(struct shell_lexline* ll, const char* line,
+    size_t pos, size_t removed, size_t inserted, size_t* rescanned)
+{
+    size_t old_len = ll->len;
+    size_t len;              /* from the edit, the line is not measured again */
+    size_t n = 0;
+    uint8_t state = 0;
+    const char* p = line;
+    struct shell_tok t;
+
+    if (pos > old_len || removed > old_len - pos || inserted > UINT32_MAX - (old_len - removed)) {
+        return EINVAL;
+    }
+    len = old_len - removed + inserted;
+
+    /* gap_lo = number of tokens starting before pos */
+    while (ll->gap_lo > 0 && ll->tok[ll->gap_lo - 1].begin >= pos) {
+        shell_lexline_move_gap(ll, ll->gap_lo - 1);
+    }
+    while (ll->gap_hi < ll->cap && old_len - ll->tok[ll->gap_hi].begin < pos) {
+        shell_lexline_move_gap(ll, ll->gap_lo + 1);
+    }
+    /* the last of them may grow or merge with the edit, restart there */
+    if (ll->gap_lo > 0) {
+        shell_lexline_move_gap(ll, ll->gap_lo - 1);
+        p = line + (old_len - ll->tok[ll->gap_hi].begin);
+        state = ll->tok[ll->gap_hi].state;
+    }
+    ll->len = len;
+
+    /* old tokens overlapping the edit are gone, offsets from the end of
+       the ones behind it are unchanged */
+    while (ll->gap_hi < ll->cap && old_len - ll->tok[ll->gap_hi].begin < pos + removed) {
+        ll->gap_hi++;
+    }
+
+    while ((p = shell_lex_next(line, p, &state, &t)) != NULL) {
+        while (ll->gap_hi < ll->cap && len - ll->tok[ll->gap_hi].begin < t.begin) {
+            ll->gap_hi++;    /* passed over */
+        }
+        if (ll->gap_hi < ll->cap && len - ll->tok[ll->gap_hi].begin == t.begin
+            && ll->tok[ll->gap_hi].state == t.state) {
+            break;           /* synchronized, the rest of the line lexes the same */
+        }
+        if (ll->gap_lo == ll->gap_hi) {
+            ll->gap_hi = ll->cap;
+            if (rescanned) *rescanned = n;
+            return ENOSPC;
+        }
+        ll->tok[ll->gap_lo++] = t;
+        n++;
+    }
+    if (p == NULL) {   /* end of line reached, nothing left to keep */
+        ll->gap_hi = ll->cap;
+    }
+
+    if (rescanned) *rescanned = n;
+    return 0;
+}
+
+SHELL_TOKEN_API size_t shell_lexline_count(const struct shell_lexline* ll)
+{
+    return ll->gap_lo + (ll->cap - ll->gap_hi);
+}
+
+SHELL_TOKEN_API struct shell_tok shell_lexline_token(const struct shell_lexline* ll, size_t i)
+{
+    struct shell_tok t;
+
+    if (i < ll->gap_lo) {
+        return ll->tok[i];
+    }
+    t = ll->tok[ll->gap_hi + (i - ll->gap_lo)];
+    t.begin = (uint32_t)(ll->len - t.begin);
+    return t;
 }
 
-#ifdef BUILD_TEST
+#if defined(BUILD_TEST) && !defined(SHELL_TOKEN_LIB)
 #if 0
 void shell_next_token(const char* input, const char** token_begin, const char** token_end, const char** context)
 {
@@ -199,12 +1093,53 @@ void shell_next_token(const char* input, const char** token_begin, const char**
 #endif
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define MAX_CMDS_IN_ONE_INPUT 4
 #define MAX_INPUT_BUFSIZ      400
 #define MAX_FRAG_BUFSIZ       200
 #define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+#define SPAN_EQ(s, b, e)  (strlen(s) == (size_t)((e) - (b)) && 0 == strncmp(s, b, (e) - (b)))
+
+static const char* const redir_str[] = { "", ">>", ">", "<", "<>", "<<", "<<-" };
+static const char* const oper_str[] = { "", "&&", "||", "&", "|", ";" };
+
+/* flatten the command tree of [input, end) to "cmd[params]>redir&&(...)" form */
+static size_t group_walk(const struct shell_group_index* idx, const char* input, const char* end,
+    char* out, size_t size)
+{
+    const char *cmdb, *cmde, *paramsb, *paramse, *redir_begin, *redir_end, *context = NULL;
+    enum shell_redir r;
+    enum shell_operator o;
+    enum shell_group g;
+    size_t n = 0;
+    int guard = 0;
+
+    do {
+        o = shell_group_split(idx, input, end, &g, &cmdb, &cmde, &paramsb, &paramse, &r,
+            &redir_begin, &redir_end, &context);
+        input = NULL;
+        if (g != SOP_GROUP_NONE) {
+            n += snprintf(out + n, size - n, "%c", g == SOP_GROUP_SUBSHELL ? '(' : '{');
+            n += group_walk(idx, cmdb, cmde, out + n, size - n);
+            n += snprintf(out + n, size - n, "%c", g == SOP_GROUP_SUBSHELL ? ')' : '}');
+        }
+        else {
+            n += snprintf(out + n, size - n, "%.*s", (int)(cmde - cmdb), cmdb);
+            if (paramse != paramsb) {
+                n += snprintf(out + n, size - n, "[%.*s]", (int)(paramse - paramsb), paramsb);
+            }
+        }
+        if (r != SOP_REDIR_NONE) {
+            n += snprintf(out + n, size - n, "%s%.*s", redir_str[r], (int)(redir_end - redir_begin), redir_begin);
+        }
+        n += snprintf(out + n, size - n, "%s", oper_str[o]);
+    } while (o != SOP_NONE && ++guard < 16);
+
+    return n;
+}
+
 int main()
 {
 
@@ -279,6 +1214,9 @@ int main()
                                                 { "echo", "0",                  SOP_AND,        SOP_REDIR_OUT,          "/proc/sys/net/ipv4/conf/bridge5/forwarding"},
                                                 { "echo", "1",                  SOP_AND,        SOP_REDIR_OUT,          "/proc/sys/net/ipv4/neigh/default/neigh_probe"},
                                                 { "echo", "1",                  SOP_NONE,       SOP_REDIR_OUT,          "/proc/sys/net/ipv6/neigh/default/neigh_probe"}}},
+        {"echo hello there",                    {"echo", "hello there",         SOP_NONE,       SOP_REDIR_NONE,        ""}},  /* last param at end of input */
+        {"echo\thello\tthere;",                 {"echo", "hello\tthere",        SOP_NEXT,       SOP_REDIR_NONE,        ""}},  /* tab separated */
+        {"echo 'a; b' 'c > d'>f",               {"echo", "'a; b' 'c > d'",      SOP_NONE,       SOP_REDIR_OUT,         "f"}},  /* single quotes */
     };
 
     for (int i = 0; i < NELEMS(t); i++) {
@@ -289,19 +1227,579 @@ int main()
         do {
             o = shell_command_param_split(input, &cmdb, &cmde, &paramsb, &paramse, &r, &redir_begin, &redir_end, &context);
             if (r != SOP_REDIR_NONE) {
-                printf(" %s  %.*s", 0 == strncmp(t[i].shell_cmd[j].cmd, cmdb, cmde - cmdb)
-                    && 0 == strncmp(t[i].shell_cmd[j].params, paramsb, paramse - paramsb)
-                    && 0 == strncmp(t[i].shell_cmd[j].redir, redir_begin, redir_end - redir_begin)
+                printf(" %s  %.*s", SPAN_EQ(t[i].shell_cmd[j].cmd, cmdb, cmde)
+                    && SPAN_EQ(t[i].shell_cmd[j].params, paramsb, paramse)
+                    && SPAN_EQ(t[i].shell_cmd[j].redir, redir_begin, redir_end)
                     && r == t[i].shell_cmd[j].redir_kind
                     && o == t[i].shell_cmd[j].oper ? "PASS" : "FAIL", (int)(redir_end - redir_begin), redir_begin);
             }
             else {
-                printf(" %s", 0 == strncmp(t[i].shell_cmd[j].cmd, cmdb, cmde - cmdb) && 0 == strncmp(t[i].shell_cmd[j].params, paramsb, paramse - paramsb) && o == t[i].shell_cmd[j].oper ? "PASS" : "FAIL");
+                printf(" %s", SPAN_EQ(t[i].shell_cmd[j].cmd, cmdb, cmde) && SPAN_EQ(t[i].shell_cmd[j].params, paramsb, paramse) && o == t[i].shell_cmd[j].oper ? "PASS" : "FAIL");
             }
             input = NULL;
         } while (o != SOP_NONE && ++j < MAX_CMDS_IN_ONE_INPUT);
     }
 
+    struct {
+        const char* input;
+        const char* result;
+        size_t unmatched;
+    } g[] = {
+        {"( cd /tmp && ls ) > /dev/null && echo done",      "(cd[/tmp]&&ls)>/dev/null&&echo[done]",         0},
+        {"{ echo 1 > /a; echo 2 > /b; } && echo 3",         "{echo[1]>/a;echo[2]>/b;}&&echo[3]",            0},
+        {"(echo \"(\" ; (echo ')')) | cat",                 "(echo[\"(\"];(echo[')']))|cat",              0},
+        {"echo $(cat /x) > y",                              "echo[$(cat /x)]>y",                            0},
+        {"( { echo a; } ; ( echo b ) )&",                   "({echo[a];};(echo[b]))&",                      0},
+        {"echo {a,b} }",                                    "echo[{a,b} }]",                                0},
+        {"{ echo a\n} && echo b",                           "{echo[a];}&&echo[b]",                          0},
+        {"( echo a",                                        "",                                             1},
+    };
+    printf("\n");
+    {   /* a list ending inside a command is cut there */
+        static const char* const in = "echo a b > /x ; echo c";
+        uint32_t match[32];
+        char out[64];
+        struct shell_group_index idx;
+
+        size_t unmatched;
+
+        shell_group_index_build(&idx, in, strlen(in), match, &unmatched);
+        group_walk(&idx, in, in + 9, out, sizeof(out));
+        printf("\n group end : %s %s", 0 == strcmp(out, "echo[a b]") ? "PASS" : "FAIL", out);
+        group_walk(&idx, in, in + 12, out, sizeof(out));
+        printf("\n group end : %s %s", 0 == strcmp(out, "echo[a b]>/") ? "PASS" : "FAIL", out);
+    }
+    for (int i = 0; i < NELEMS(g); i++) {
+        uint32_t match[MAX_INPUT_BUFSIZ];
+        char out[MAX_INPUT_BUFSIZ];
+        struct shell_group_index idx;
+        size_t unmatched;
+        int rc = shell_group_index_build(&idx, g[i].input, strlen(g[i].input), match, &unmatched);
+
+        out[0] = '\0';
+        group_walk(&idx, g[i].input, NULL, out, sizeof(out));
+        printf("\n group %d : %s %s", i, 0 == rc && unmatched == g[i].unmatched && 0 == strcmp(out, g[i].result)
+            ? "PASS" : "FAIL", out);
+    }
+
+    struct {
+        const char* input;
+        struct {
+            const char* cmd;
+            enum shell_redir redir_kind;
+            const char* redir;
+            const char* delim;
+            const char* body;
+            int strip_tabs;
+            int quoted;
+            enum shell_operator oper;
+        } shell_cmd[MAX_CMDS_IN_ONE_INPUT];
+    } h[] = {
+        {"cat <<EOF > /etc/foo.conf\nline 1\nline (2) 'x\nEOF\necho done",
+            {{"cat", SOP_REDIR_OUT, "/etc/foo.conf", "EOF", "line 1\nline (2) 'x\n", 0, 0, SOP_NEXT},
+             {"echo", SOP_REDIR_NONE, "", "", "", 0, 0, SOP_NONE}}},
+        {"cat >> f <<-'END'\n\tone\n\ttwo $x\n\tEND\n",
+            {{"cat", SOP_REDIR_OUT_APPEND, "f", "'END'", "\tone\n\ttwo $x\n", 1, 1, SOP_NEXT},
+             {"", SOP_REDIR_NONE, "", "", "", 0, 0, SOP_NONE}}},
+        {"cat <<A | sort\nb\na\nA\nls",
+            {{"cat", SOP_REDIR_NONE, "", "A", "b\na\n", 0, 0, SOP_PIPE},
+             {"sort", SOP_REDIR_NONE, "", "", "", 0, 0, SOP_NEXT},
+             {"ls", SOP_REDIR_NONE, "", "", "", 0, 0, SOP_NONE}}},
+        {"cat <<EOF\nabc",
+            {{"cat", SOP_REDIR_NONE, "", "EOF", "abc", 0, 0, SOP_NEXT},
+             {"", SOP_REDIR_NONE, "", "", "", 0, 0, SOP_NONE}}},
+    };
+    for (int i = 0; i < NELEMS(h); i++) {
+        struct shell_heredoc hd;
+        const char* input = h[i].input;
+        int j = 0, pass = 1;
+
+        memset(&hd, 0, sizeof(hd));
+        do {
+            o = shell_heredoc_split(input, &cmdb, &cmde, &paramsb, &paramse, &r, &redir_begin, &redir_end, &hd, &context);
+            pass = pass && SPAN_EQ(h[i].shell_cmd[j].cmd, cmdb, cmde)
+                && r == h[i].shell_cmd[j].redir_kind && SPAN_EQ(h[i].shell_cmd[j].redir, redir_begin, redir_end)
+                && SPAN_EQ(h[i].shell_cmd[j].delim, hd.delim_begin, hd.delim_end)
+                && SPAN_EQ(h[i].shell_cmd[j].body, hd.body_begin, hd.body_end)
+                && hd.strip_tabs == h[i].shell_cmd[j].strip_tabs && hd.quoted == h[i].shell_cmd[j].quoted
+                && o == h[i].shell_cmd[j].oper;
+            input = NULL;
+        } while (o != SOP_NONE && ++j < MAX_CMDS_IN_ONE_INPUT);
+        printf("\n heredoc %d : %s", i, pass ? "PASS" : "FAIL");
+    }
+
+    {   /* in process `cat <<-EOF > file` */
+        char path[] = "/tmp/shell_token_XXXXXX";
+        char buf[MAX_FRAG_BUFSIZ];
+        const char* script = "cat <<-EOF > \"/tmp/shell_token_XXXXXX\"\n\tkey=1\n\t\tindent\n\nEOF\n";
+        struct shell_heredoc hd;
+        uint32_t match[MAX_INPUT_BUFSIZ];
+        struct shell_group_index idx;
+        char s[MAX_INPUT_BUFSIZ];
+        int fd = mkstemp(path);
+        ssize_t n = -1;
+        size_t unmatched;
+
+        memcpy(s, script, strlen(script) + 1);
+        memcpy(strstr(s, "/tmp/"), path, strlen(path));
+        memset(&hd, 0, sizeof(hd));
+        shell_heredoc_split(s, &cmdb, &cmde, &paramsb, &paramse, &r, &redir_begin, &redir_end, &hd, &context);
+        if (fd >= 0 && 0 == shell_heredoc_redirect(&hd, r, redir_begin, redir_end)) {
+            n = read(fd, buf, sizeof(buf));
+        }
+        printf("\n heredoc redirect : %s", n == 14 && 0 == memcmp(buf, "key=1\nindent\n\n", 14) ? "PASS" : "FAIL");
+        printf("\n heredoc index : %s", 0 == shell_group_index_build(&idx, "( cat <<E\n) ( '\nE\n)", 19, match, &unmatched)
+            && 0 == unmatched && match[0] == 18 ? "PASS" : "FAIL");
+        {
+            static const char five[] = "cat <<A <<B <<C <<D <<E\nA\nB\nC\nD\n(\nE\n";
+            uint32_t m5[sizeof(five)];
+
+            printf("\n heredoc index limit : %s", EOVERFLOW == shell_group_index_build(&idx, five, sizeof(five) - 1,
+                m5, &unmatched) ? "PASS" : "FAIL");
+        }
+        if (fd >= 0) {
+            close(fd);
+            unlink(path);
+        }
+    }
+
+    {   /* incremental lexing against a full parse, typing then random edits */
+        static const char typed[] = "echo 2 > /proc/sys/net/ipv4/conf/bridge0.1/arp_ignore && cat <<E | sort ; (ls -l) &";
+        static const char alphabet[] = "ab  \t>|&;()'\"$<-";
+        struct shell_tok tok[MAX_FRAG_BUFSIZ], ref_tok[MAX_FRAG_BUFSIZ];
+        struct shell_lexline ll, ref;
+        char line[MAX_FRAG_BUFSIZ];
+        size_t len = 0, rescanned, worst = 0;
+        int pass = 1;
+
+        shell_lexline_init(&ll, tok, NELEMS(tok));
+        shell_lexline_init(&ref, ref_tok, NELEMS(ref_tok));
+        line[0] = '\0';
+        shell_lexline_parse(&ll, line);
+        for (size_t i = 0; i < strlen(typed); i++) {
+            line[len++] = typed[i];
+            line[len] = '\0';
+            pass = pass && 0 == shell_lexline_edit(&ll, line, len - 1, 0, 1, &rescanned);
+            worst = rescanned > worst ? rescanned : worst;
+        }
+        printf("\n lexline typing : %s %zu", pass && worst <= 2 && shell_lexline_count(&ll) == 16 ? "PASS" : "FAIL", worst);
+
+        worst = 0;
+        for (int i = 0; i < 4; i++) {   /* letters typed in the middle */
+            size_t pos = 20 + i;
+            memmove(line + pos + 1, line + pos, len - pos + 1);
+            line[pos] = 'x';
+            len++;
+            pass = pass && 0 == shell_lexline_edit(&ll, line, pos, 0, 1, &rescanned);
+            worst = rescanned > worst ? rescanned : worst;
+        }
+        printf("\n lexline middle : %s %zu", pass && worst <= 2 ? "PASS" : "FAIL", worst);
+
+        srand(1);
+        for (int i = 0; i < 2000 && pass; i++) {
+            size_t pos = rand() % (len + 1);
+            size_t removed = rand() % 3;
+            size_t inserted = (len < NELEMS(line) / 2) ? rand() % 3 : 0;
+
+            removed = (pos + removed > len) ? len - pos : removed;
+            memmove(line + pos + inserted, line + pos + removed, len - pos - removed + 1);
+            for (size_t k = 0; k < inserted; k++) {
+                line[pos + k] = alphabet[rand() % (sizeof(alphabet) - 1)];
+            }
+            len = len - removed + inserted;
+            pass = 0 == shell_lexline_edit(&ll, line, pos, removed, inserted, NULL)
+                && 0 == shell_lexline_parse(&ref, line)
+                && shell_lexline_count(&ll) == shell_lexline_count(&ref);
+            for (size_t k = 0; pass && k < shell_lexline_count(&ref); k++) {
+                struct shell_tok a = shell_lexline_token(&ll, k), b = shell_lexline_token(&ref, k);
+                pass = a.begin == b.begin && a.len == b.len && a.kind == b.kind && a.state == b.state;
+            }
+        }
+        printf("\n lexline random edits : %s", pass ? "PASS" : "FAIL");
+        printf("\n lexline bad edit : %s", EINVAL == shell_lexline_edit(&ll, line, ll.len, 1, 0, NULL) ? "PASS" : "FAIL");
+    }
+    printf("\n");
+
+    return 0;
+}
+#endif
+
+#if defined(BUILD_BENCH) && !defined(SHELL_TOKEN_LIB)
+/*
+ * Tokenizer benchmark. Generates corpora that look like the commands we
+ * actually feed the tokenizer (sysctl echos, long option-heavy lines,
+ * quote-heavy lines and long && chains) or loads them from files given on
+ * the command line, one input per line. Every variant is timed over each
+ * corpus and its output is compared against ref_param_split(), a plain
+ * index walk over the same grammar that serves as the regression oracle.
+ *
+ *     gcc -O2 -DBUILD_BENCH shell_token.c -o shell_token_bench
+ *     ./shell_token_bench [corpus.txt ...]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_LINES         4096
+#define BENCH_MIN_NSEC      200000000ull   /* time each variant at least this long */
+#define BENCH_MAX_SEGMENTS  64             /* guard against runaway context loops */
+#define MAX_LINE_BUFSIZ     4096
+#define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+typedef enum shell_operator (*shell_split_fn)(const char* input,
+    const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end,
+    enum shell_redir* sop_redir, const char** redir_begin, const char** redir_end,
+    const char** context);
+
+static int ref_is_blank(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static int ref_is_seper(char c)
+{
+    return c == '\0' || ref_is_blank(c) || c == '>' || c == '<' || c == '|' || c == '&' || c == ';'
+        || c == '(' || c == ')' || c == '\n';
+}
+
+static size_t ref_quote(const char* s, size_t i)
+{
+    char q = s[i++];
+    while (s[i] && s[i] != q) {
+        i++;
+    }
+    return s[i] ? i + 1 : i;
+}
+
+static size_t ref_blank(const char* s, size_t i)
+{
+    while (ref_is_blank(s[i])) {
+        i++;
+    }
+    return i;
+}
+
+static size_t ref_word(const char* s, size_t i)
+{
+    while (!ref_is_seper(s[i])) {
+        if (s[i] == '\"' || s[i] == '\'') {
+            i = ref_quote(s, i);
+        }
+        else if (s[i] == '$' && s[i + 1] == '(') {
+            int depth = 1;
+            for (i += 2; s[i] && depth; ) {
+                if (s[i] == '\"' || s[i] == '\'') {
+                    i = ref_quote(s, i);
+                    continue;
+                }
+                depth += (s[i] == '(') - (s[i] == ')');
+                i++;
+            }
+        }
+        else {
+            i++;
+        }
+    }
+    return i;
+}
+
+/* reference tokenizer, see shell_command_param_split() for the contract */
+static enum shell_operator ref_param_split(const char* input, const char** cmd_begin, const char** cmd_end,
+    const char** params_begin, const char** params_end, enum shell_redir* sop_redir, const char** redir_begin,
+    const char** redir_end, const char** context)
+{
+    const char* s = (input != NULL) ? input : *context;
+    enum shell_operator o = SOP_NONE;
+    size_t i = ref_blank(s, 0), j;
+
+    *params_begin = *params_end = NULL;
+    *redir_begin = *redir_end = NULL;
+    *sop_redir = SOP_REDIR_NONE;
+    *cmd_begin = *cmd_end = s + i;
+
+    if (s[i] == '\0') {
+        *context = s + i;
+        return SOP_NONE;
+    }
+
+    i = ref_word(s, i);
+    *cmd_end = s + i;
+
+    if (ref_is_blank(s[i])) {
+        i = ref_blank(s, i);
+        *params_begin = *params_end = s + i;
+        while ((j = ref_word(s, i)) != i) {
+            *params_end = s + j;
+            i = j;
+            if (!ref_is_blank(s[i])) {
+                break;
+            }
+            i = ref_blank(s, i);
+        }
+    }
+
+    if (s[i] == '>') {
+        *sop_redir = (s[i + 1] == '>') ? SOP_REDIR_OUT_APPEND : SOP_REDIR_OUT;
+        i += (s[i + 1] == '>') ? 2 : 1;
+    }
+    else if (s[i] == '<' && s[i + 1] == '<') {
+        *sop_redir = (s[i + 2] == '-') ? SOP_REDIR_HEREDOC_STRIP : SOP_REDIR_HEREDOC;
+        i += (s[i + 2] == '-') ? 3 : 2;
+    }
+    else if (s[i] == '<') {
+        *sop_redir = (s[i + 1] == '>') ? SOP_REDIR_INOUT : SOP_REDIR_IN;
+        i += (s[i + 1] == '>') ? 2 : 1;
+    }
+
+    if (*sop_redir != SOP_REDIR_NONE && s[i]) {
+        i = ref_blank(s, i);
+        *redir_begin = *redir_end = s + i;
+        if (s[i]) {
+            i = ref_word(s, i);
+            *redir_end = s + i;
+            i = ref_blank(s, i);
+        }
+    }
+
+    if (s[i] == '&') {
+        o = (s[i + 1] == '&') ? SOP_AND : SOP_BG;
+        i += (s[i + 1] == '&') ? 2 : 1;
+    }
+    else if (s[i] == '|') {
+        o = (s[i + 1] == '|') ? SOP_OR : SOP_PIPE;
+        i += (s[i + 1] == '|') ? 2 : 1;
+    }
+    else if (s[i] == ';' || s[i] == '\n') {
+        o = SOP_NEXT;
+        i++;
+    }
+
+    *context = s + i;
+    return o;
+}
+
+static const struct {
+    const char* name;
+    shell_split_fn fn;
+} variants[] = {
+    { "param_split", shell_command_param_split },
+    { "reference",   ref_param_split },
+};
+
+struct corpus {
+    const char* name;
+    char* buf;            /* NUL separated inputs */
+    size_t* offs;         /* start of each input in buf */
+    size_t n;
+    size_t cap;
+    size_t bytes;         /* input bytes, terminators excluded */
+    size_t used;
+};
+
+static void corpus_add(struct corpus* c, const char* line, size_t len)
+{
+    if (c->n == c->cap) {
+        c->cap = c->cap ? 2 * c->cap : 1024;
+        c->offs = realloc(c->offs, c->cap * sizeof(*c->offs));
+    }
+    c->buf = realloc(c->buf, c->used + len + 1);
+    if (NULL == c->buf || NULL == c->offs) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memcpy(c->buf + c->used, line, len);
+    c->buf[c->used + len] = '\0';
+    c->offs[c->n++] = c->used;
+    c->used += len + 1;
+    c->bytes += len;
+}
+
+static uint32_t bench_rand(uint32_t* seed)
+{
+    *seed = *seed * 1103515245u + 12345u;
+    return *seed >> 8;
+}
+
+static const char* const sysctl_knobs[] = {
+    "arp_ignore", "arp_announce", "proxy_arp", "forwarding", "accept_ra", "rp_filter",
+};
+
+static void corpus_gen_sysctl(struct corpus* c, uint32_t seed)
+{
+    char line[MAX_LINE_BUFSIZ];
+    for (int i = 0; i < BENCH_LINES; i++) {
+        int len = snprintf(line, sizeof(line), "echo %u > /proc/sys/net/ipv%c/conf/bridge%u/%s",
+            bench_rand(&seed) % 3, (bench_rand(&seed) & 1) ? '4' : '6', bench_rand(&seed) % 16,
+            sysctl_knobs[bench_rand(&seed) % NELEMS(sysctl_knobs)]);
+        corpus_add(c, line, len);
+    }
+}
+
+static void corpus_gen_options(struct corpus* c, uint32_t seed)
+{
+    char line[MAX_LINE_BUFSIZ];
+    for (int i = 0; i < BENCH_LINES; i++) {
+        unsigned b = bench_rand(&seed) % 16;
+        int len = snprintf(line, sizeof(line), "dnsmasq --conf-file=/etc/data/dnsmasq%u.conf"
+            " --dhcp-leasefile=/var/run/data/dnsmasq%u.leases --addn-hosts=/etc/data/hosts"
+            " --pid-file=/var/run/data/dnsmasq%u.pid -i bridge%u -I lo -z"
+            " --dhcp-script=/bin/dnsmasq_script.sh type_inst=dnsv%c > /var/run/data/dnsmasq_env%u.conf",
+            b, b, b, b, (bench_rand(&seed) & 1) ? '4' : '6', b);
+        corpus_add(c, line, len);
+    }
+}
+
+static void corpus_gen_quotes(struct corpus* c, uint32_t seed)
+{
+    char line[MAX_LINE_BUFSIZ];
+    for (int i = 0; i < BENCH_LINES; i++) {
+        unsigned v = bench_rand(&seed) % 1000;
+        int len = snprintf(line, sizeof(line), "echo \"key=%u; value > %u\" 'a | b && c' \"\" \"x<>y\" '%u;' >> /tmp/log%u.txt",
+            v, v * 7, v, v % 8);
+        corpus_add(c, line, len);
+    }
+}
+
+static void corpus_gen_chains(struct corpus* c, uint32_t seed)
+{
+    char line[MAX_LINE_BUFSIZ];
+    for (int i = 0; i < BENCH_LINES / 16; i++) {
+        int len = 0;
+        for (int k = 0; k < 16; k++) {
+            len += snprintf(line + len, sizeof(line) - len, "%secho %u > /proc/sys/net/ipv4/conf/bridge%u/%s",
+                k ? " && " : "", bench_rand(&seed) % 2, bench_rand(&seed) % 16,
+                sysctl_knobs[bench_rand(&seed) % NELEMS(sysctl_knobs)]);
+        }
+        corpus_add(c, line, len);
+    }
+}
+
+static int corpus_load(struct corpus* c, const char* path)
+{
+    char line[MAX_LINE_BUFSIZ];
+    FILE* f = fopen(path, "r");
+    if (NULL == f) {
+        perror(path);
+        return -1;
+    }
+    c->name = path;
+    while (fgets(line, sizeof(line), f)) {
+        size_t len = strcspn(line, "\r\n");
+        if (len) {
+            corpus_add(c, line, len);
+        }
+    }
+    fclose(f);
     return 0;
 }
-#endif
\ No newline at end of file
+
+static uint64_t bench_nsec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* split every input once with fn and ref, count inputs that differ */
+static size_t bench_verify(const struct corpus* c, shell_split_fn fn)
+{
+    size_t bad = 0;
+    for (size_t i = 0; i < c->n; i++) {
+        const char* in = c->buf + c->offs[i];
+        const char *ctx1 = NULL, *ctx2 = NULL;
+        const char* a[6];
+        const char* b[6];
+        enum shell_redir ra, rb;
+        enum shell_operator oa, ob;
+        int seg = 0;
+        do {
+            oa = fn(seg ? NULL : in, &a[0], &a[1], &a[2], &a[3], &ra, &a[4], &a[5], &ctx1);
+            ob = ref_param_split(seg ? NULL : in, &b[0], &b[1], &b[2], &b[3], &rb, &b[4], &b[5], &ctx2);
+            if (oa != ob || ra != rb || ctx1 != ctx2 || 0 != memcmp(a, b, sizeof(a))) {
+                if (bad++ < 3) {
+                    fprintf(stderr, "  mismatch at segment %d of: %s\n", seg, in);
+                }
+                break;
+            }
+        } while (oa != SOP_NONE && ++seg < BENCH_MAX_SEGMENTS);
+    }
+    return bad;
+}
+
+static uint64_t bench_run(const struct corpus* c, shell_split_fn fn, size_t* cmds)
+{
+    uintptr_t sum = 0;
+    for (size_t i = 0; i < c->n; i++) {
+        const char* in = c->buf + c->offs[i];
+        const char *cb, *ce, *pb, *pe, *rdb, *rde, *ctx = NULL;
+        enum shell_redir r;
+        enum shell_operator o;
+        int seg = 0;
+        do {
+            o = fn(seg ? NULL : in, &cb, &ce, &pb, &pe, &r, &rdb, &rde, &ctx);
+            sum += (uintptr_t)ce + (uintptr_t)pe + (uintptr_t)rde + r;
+            (*cmds)++;
+        } while (o != SOP_NONE && ++seg < BENCH_MAX_SEGMENTS);
+    }
+    return sum;
+}
+
+int main(int argc, char* argv[])
+{
+    struct corpus corpora[8];
+    size_t ncorpora = 0;
+    volatile uintptr_t sink = 0;
+    int rc = 0;
+
+    memset(corpora, 0, sizeof(corpora));
+    if (argc > 1) {
+        for (int i = 1; i < argc && ncorpora < NELEMS(corpora); i++) {
+            if (0 == corpus_load(&corpora[ncorpora], argv[i])) {
+                ncorpora++;
+            }
+        }
+    }
+    else {
+        corpora[0].name = "sysctl";  corpus_gen_sysctl(&corpora[0], 1);
+        corpora[1].name = "options"; corpus_gen_options(&corpora[1], 2);
+        corpora[2].name = "quotes";  corpus_gen_quotes(&corpora[2], 3);
+        corpora[3].name = "chains";  corpus_gen_chains(&corpora[3], 4);
+        ncorpora = 4;
+    }
+
+    printf("%-12s %8s %8s  %-12s %12s %12s %8s %10s\n",
+        "corpus", "inputs", "bytes/in", "variant", "inputs/s", "commands/s", "ns/byte", "mismatch");
+    for (size_t k = 0; k < ncorpora; k++) {
+        const struct corpus* c = &corpora[k];
+        if (0 == c->n) {
+            continue;
+        }
+        for (size_t v = 0; v < NELEMS(variants); v++) {
+            size_t bad = bench_verify(c, variants[v].fn);
+            size_t cmds = 0, iters = 0;
+            uint64_t t0 = bench_nsec(), dt;
+            do {
+                sink += bench_run(c, variants[v].fn, &cmds);
+                iters++;
+                dt = bench_nsec() - t0;
+            } while (dt < BENCH_MIN_NSEC);
+
+            printf("%-12s %8zu %8zu  %-12s %12.0f %12.0f %8.3f %10zu\n",
+                c->name, c->n, c->bytes / c->n, variants[v].name,
+                1e9 * (double)(iters * c->n) / dt, 1e9 * (double)cmds / dt,
+                (double)dt / (double)(iters * c->bytes), bad);
+            if (bad) {
+                rc = 1;
+            }
+        }
+    }
+
+    for (size_t k = 0; k < ncorpora; k++) {
+        free(corpora[k].buf);
+        free(corpora[k].offs);
+    }
+    return rc;
+}
+#endif
@@ -0,0 +1,323 @@
+/******************************************************************************
+  @file   shell_token.hpp
+  @brief
+
+  DESCRIPTION: header only C++ front end of shell_token.c.
+
+  Commands, their words and their redirections are lazy forward ranges of
+  std::string_view over the input. An iterator holds the tokenizer context
+  and the current command, nothing is allocated, and a range-based for
+  loop inlines to the same loop as the C API.
+
+      for (const shell_token::command& c : shell_token::commands(input)) {
+          for (std::string_view w : c.words()) { ... }
+      }
+
+  The ranges point into the input, which must outlive them : a temporary
+  std::string is refused at compile time.
+
+  The C functions are compiled static inline in every translation unit
+  including this header.
+
+****************************************************************************/
+#ifndef SHELL_TOKEN_HPP
+#define SHELL_TOKEN_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#ifndef SHELL_TOKEN_API
+#define SHELL_TOKEN_API static inline
+#endif
+#define SHELL_TOKEN_LIB
+#include "shell_token.c"
+#undef IS_BLANK
+#undef IS_SEPER
+#undef EAT_BLANK
+#undef GET_CHAR
+#undef GET_SEPER
+
+namespace shell_token {
+
+inline std::string_view span(const char* b, const char* e)
+{
+    return b ? std::string_view(b, e - b) : std::string_view();
+}
+
+/* blank separated words of a span. quoted strings and $( .. ) stay part
+   of their word, quotes are not removed */
+class words {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = std::string_view;
+
+        iterator() = default;
+        iterator(const char* p, const char* end) : end_(end) { seek(p); }
+
+        std::string_view operator*() const { return word_; }
+        pointer operator->() const { return &word_; }
+        iterator& operator++() { seek(word_.data() + word_.size()); return *this; }
+        iterator operator++(int) { iterator t = *this; ++*this; return t; }
+        bool operator==(const iterator& o) const { return word_.data() == o.word_.data(); }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        static bool blank(char c) { return c == ' ' || c == '\t'; }
+
+        const char* quote(const char* p) const
+        {
+            char q = *p++;
+            while (p < end_ && *p != q) p++;
+            return (p < end_) ? p + 1 : p;
+        }
+
+        void seek(const char* p)
+        {
+            const char* b;
+
+            while (p < end_ && blank(*p)) p++;
+            b = p;
+            while (p < end_ && !blank(*p)) {
+                if (*p == '\"' || *p == '\'') {
+                    p = quote(p);
+                }
+                else if (*p == '$' && p + 1 < end_ && p[1] == '(') {
+                    int num = 1;
+                    for (p += 2; p < end_ && num; ) {
+                        if (*p == '\"' || *p == '\'') {
+                            p = quote(p);
+                            continue;
+                        }
+                        num += (*p == '(') - (*p == ')');
+                        p++;
+                    }
+                }
+                else {
+                    p++;
+                }
+            }
+            word_ = std::string_view(b, p - b);
+        }
+
+        std::string_view word_;
+        const char* end_ = nullptr;
+    };
+
+    explicit words(std::string_view s) : begin_(s.data(), s.data() + s.size()), end_(s.data() + s.size(), s.data() + s.size()) {}
+
+    iterator begin() const { return begin_; }
+    iterator end() const { return end_; }
+
+private:
+    iterator begin_;
+    iterator end_;
+};
+
+struct redirection {
+    enum shell_redir kind;         /* SOP_REDIR_NONE if the command has none */
+    std::string_view target;
+};
+
+struct command {
+    std::string_view name;         /* command word */
+    std::string_view params;       /* parameters, as written */
+    struct redirection redir;
+    enum shell_operator oper;      /* operator following the command */
+
+    shell_token::words words() const { return shell_token::words(params); }
+};
+
+/* simple commands of a nul terminated input, empty commands skipped */
+class commands {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = command;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const command*;
+        using reference = const command&;
+
+        iterator() = default;    /* end */
+        explicit iterator(const char* input) { next(input); }
+
+        const command& operator*() const { return cur_; }
+        const command* operator->() const { return &cur_; }
+        iterator& operator++()
+        {
+            if (cur_.oper == SOP_NONE) {
+                context_ = nullptr;
+            }
+            else {
+                next(nullptr);
+            }
+            return *this;
+        }
+        iterator operator++(int) { iterator t = *this; ++*this; return t; }
+        bool operator==(const iterator& o) const { return context_ == o.context_; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        void next(const char* input)
+        {
+            const char *cmdb, *cmde, *paramsb, *paramse, *redir_begin, *redir_end;
+
+            for (;;) {
+                cur_.oper = shell_command_param_split(input, &cmdb, &cmde, &paramsb, &paramse,
+                    &cur_.redir.kind, &redir_begin, &redir_end, &context_);
+                input = nullptr;
+                if (cmdb != cmde || cur_.redir.kind != SOP_REDIR_NONE) {
+                    break;
+                }
+                if (cur_.oper == SOP_NONE) {
+                    context_ = nullptr;
+                    return;
+                }
+            }
+            cur_.name = span(cmdb, cmde);
+            cur_.params = span(paramsb, paramse);
+            cur_.redir.target = span(redir_begin, redir_end);
+        }
+
+        command cur_{};
+        const char* context_ = nullptr;
+    };
+
+    explicit commands(const char* input) : input_(input) {}
+    explicit commands(const std::string& input) : input_(input.c_str()) {}
+    explicit commands(std::string&&) = delete;      /* the input must outlive the range */
+
+    iterator begin() const { return iterator(input_); }
+    iterator end() const { return iterator(); }
+
+private:
+    const char* input_;
+};
+
+/* redirections of the commands of a nul terminated input */
+class redirections {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = redirection;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const redirection*;
+        using reference = const redirection&;
+
+        iterator() = default;
+        explicit iterator(commands::iterator it) : it_(it) { skip(); }
+
+        const redirection& operator*() const { return it_->redir; }
+        const redirection* operator->() const { return &it_->redir; }
+        iterator& operator++() { ++it_; skip(); return *this; }
+        iterator operator++(int) { iterator t = *this; ++*this; return t; }
+        bool operator==(const iterator& o) const { return it_ == o.it_; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        void skip()
+        {
+            while (it_ != commands::iterator() && it_->redir.kind == SOP_REDIR_NONE) {
+                ++it_;
+            }
+        }
+
+        commands::iterator it_;
+    };
+
+    explicit redirections(const char* input) : input_(input) {}
+    explicit redirections(const std::string& input) : input_(input.c_str()) {}
+    explicit redirections(std::string&&) = delete;      /* the input must outlive the range */
+
+    iterator begin() const { return iterator(commands(input_).begin()); }
+    iterator end() const { return iterator(); }
+
+private:
+    const char* input_;
+};
+
+} /* namespace shell_token */
+
+#ifdef BUILD_TEST
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static size_t allocations;
+
+void* operator new(std::size_t n)
+{
+    allocations++;
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+int main()
+{
+    struct {
+        const char* input;
+        const char* result;   /* name[word|word]redir target oper */
+    } t[] = {
+        { "echo 2 > /proc/sys/net/ipv4/conf/bridge0.1/arp_ignore",
+          "echo[2]> /proc/sys/net/ipv4/conf/bridge0.1/arp_ignore" },
+        { "  printf '%s x' \"a b\"  $(cat /x y) >> /b && ls -l ; ; cat < in | wc",
+          "printf['%s x'|\"a b\"|$(cat /x y)]>> /b&&ls[-l];cat< in|wc" },
+        { "",               "" },
+        { " ; ;",           "" },
+        { "a &",            "a&" },
+        { "> f",            "> f" },
+    };
+    static const char* const redir[] = { "", ">>", ">", "<", "<>", "<<", "<<-" };
+    static const char* const oper[] = { "", "&&", "||", "&", "|", ";" };
+
+    for (size_t i = 0; i < sizeof(t) / sizeof(t[0]); i++) {
+        char out[512];
+        size_t n = 0, before = allocations;
+
+        out[0] = '\0';
+        for (const shell_token::command& c : shell_token::commands(t[i].input)) {
+            const char* sep = "[";
+
+            n += snprintf(out + n, sizeof(out) - n, "%.*s", (int)c.name.size(), c.name.data());
+            for (std::string_view w : c.words()) {
+                n += snprintf(out + n, sizeof(out) - n, "%s%.*s", sep, (int)w.size(), w.data());
+                sep = "|";
+            }
+            n += snprintf(out + n, sizeof(out) - n, "%s", *sep == '|' ? "]" : "");
+            if (c.redir.kind != SOP_REDIR_NONE) {
+                n += snprintf(out + n, sizeof(out) - n, "%s %.*s", redir[c.redir.kind],
+                    (int)c.redir.target.size(), c.redir.target.data());
+            }
+            n += snprintf(out + n, sizeof(out) - n, "%s", oper[c.oper]);
+        }
+        printf("%s %zu : %s\n", 0 == strcmp(out, t[i].result) && allocations == before ? "PASS" : "FAIL", i, out);
+    }
+
+    {
+        std::string s = "echo a > /x ; echo b ; cat < /y";
+        std::string targets;
+
+        for (const shell_token::redirection& r : shell_token::redirections(s)) {
+            targets += std::string(redir[r.kind]) + std::string(r.target);
+        }
+        printf("%s redirections : %s\n", targets == ">/x</y" ? "PASS" : "FAIL", targets.c_str());
+    }
+
+    return 0;
+}
+#endif
+
+#endif /* SHELL_TOKEN_HPP */
@@ -1,56 +1,633 @@
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* prefixes the functions, simplify_path.hpp makes them static inline */
+#ifndef SIMPLIFY_PATH_API
+#define SIMPLIFY_PATH_API
+#endif
+
+/* reduce the fragment following the separator at rd1, wr follows the
+   separator written last. Returns the end of the fragment */
+static inline const char* simplify_fragment(char* root, char** pwr, const char* rd1, const char* end)
+{
+    char* wr = *pwr;
+    const char* rd2;
+    size_t n;
+
+    rd1++;
+    rd2 = (const char*)memchr(rd1, '/', end - rd1);   /* find end of this fragment */
+    rd2 = rd2 ? rd2 : end;
+    n = rd2 - rd1;
+    if (n == 0 || (n == 1 && rd1[0] == '.')) {
+        /* nothing to copy */
+    }
+    else if (n == 2 && rd1[0] == '.' && rd1[1] == '.') {
+        /* reverse travel without exiting the root */
+        if ((wr-1) != root) {
+            wr -= 2;
+            while (*wr != '/') {
+                wr--;
+            }
+            wr++;
+        }
+    }
+    else {
+        /* write the fragment and its separator */
+        memmove(wr, rd1, n);
+        wr += n;
+        if (rd2 < end) {
+            *wr++ = '/';
+        }
+    }
+    *pwr = wr;
+    return rd2;
+}
+
+#ifdef __AVX2__
+static inline uint64_t simplify_mask(const char* s, char c)
+{
+    __m256i v = _mm256_set1_epi8(c);
+    uint32_t lo = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)s), v));
+    uint32_t hi = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(s + 32)), v));
+
+    return (uint64_t)hi << 32 | lo;
+}
+
+/* separators of the window at w starting "//", "/./" or "/../" */
+static inline uint64_t simplify_bad(const char* w)
+{
+    uint64_t sl = simplify_mask(w, '/');
+    uint64_t dot = simplify_mask(w, '.');
+
+    return sl & ((sl >> 1) | (dot >> 1 & sl >> 2) | (dot >> 1 & dot >> 2 & sl >> 3));
+}
+#endif
+
+/* 1 if path[0, len) is an absolute path simplify_path leaves unchanged :
+   no "//", "/./" or "/../", no trailing "/", "/." or "/..", except "/" */
+SIMPLIFY_PATH_API int is_canonical_path(const char* path, size_t len)
+{
+    size_t i = 0;
+
+    if (len == 0 || *path != '/') {
+        return 0;
+    }
+    if (len == 1) {
+        return 1;
+    }
+#ifdef __AVX2__
+    while (i < len) {   /* the end reads as a separator */
+        size_t left = len - i, lim = (left < 61) ? left : 61;
+        const char* w = path + i;
+        char pad[64];
+
+        if (left < 64) {
+            memcpy(pad, w, left);
+            pad[left] = '/';
+            memset(pad + left + 1, 'x', 63 - left);
+            w = pad;
+        }
+        if (simplify_bad(w) & (((uint64_t)1 << lim) - 1)) {
+            return 0;
+        }
+        i += lim;
+    }
+#else
+    for (const char* p = path; p; p = (const char*)memchr(p + 1, '/', len - i - 1)) {
+        char c1, c2, c3;
+
+        i = p - path;
+        c1 = (i + 1 < len) ? p[1] : '/';
+        c2 = (i + 2 < len) ? p[2] : '/';
+        c3 = (i + 3 < len) ? p[3] : '/';
+        if (c1 == '/' || (c1 == '.' && (c2 == '/' || (c2 == '.' && c3 == '/')))) {
+            return 0;
+        }
+    }
+#endif
+    return 1;
+}
+
+/* reduce the POSIX absolute path path[0, len) in place, the slice need
+   not be nul terminated. Returns the reduced length, 0 if the path does
+   not begin with the root directory.
+
+   With AVX2, 64 bytes are turned into '/' and '.' bit masks and the
+   separators starting "//", "/./" and "/../" are found with shifts and
+   ands. Fragments up to the first of them are copied as one run, not at
+   all while nothing was removed yet, and only that separator goes through
+   the fragment by fragment reduction */
+SIMPLIFY_PATH_API size_t simplify_path_len(char* path, size_t len)
+{
+    char* wr = path + 1;
+    const char* rd1 = path;
+    const char* end = path + len;
+    size_t n;
+
+    if (len == 0 || *path != '/') {
+        return 0;   /* exception */
+    }
+    if (is_canonical_path(path, len)) {
+        return len;     /* nothing to write */
+    }
+
+    while (rd1 < end) {
+#ifdef __AVX2__
+        {
+            const char* w = rd1;
+            size_t left = end - rd1, lim = (left < 61) ? left : 61, pos = 0;
+            char pad[64];
+            uint64_t sl, dot, bad, run;
+
+            if (left < 64) {    /* the end reads as a separator */
+                memcpy(pad, rd1, left);
+                pad[left] = '/';
+                memset(pad + left + 1, 'x', 63 - left);
+                w = pad;
+            }
+            sl = simplify_mask(w, '/');
+            dot = simplify_mask(w, '.');
+            bad = sl & ((sl >> 1) | (dot >> 1 & sl >> 2) | (dot >> 1 & dot >> 2 & sl >> 3));
+            bad &= ((uint64_t)1 << lim) - 1;
+
+            while (pos < lim) {   /* separators before lim have their 3 next bytes in the window */
+                if (bad >> pos & 1) {
+                    if (sl >> (pos + 1) & 1) {          /* "//" */
+                        pos += 1;
+                    }
+                    else if (sl >> (pos + 2) & 1) {     /* "/./" */
+                        pos += 2;
+                    }
+                    else {                              /* "/../" */
+                        if ((wr-1) != path) {
+                            wr -= 2;
+                            while (*wr != '/') {
+                                wr--;
+                            }
+                            wr++;
+                        }
+                        pos += 3;
+                    }
+                    continue;
+                }
+                /* copy the fragments up to the next bad separator as one run */
+                run = bad & ~(((uint64_t)2 << pos) - 1);
+                run = sl & ~(((uint64_t)2 << pos) - 1) & ((run ? run & -run : (uint64_t)1 << lim) * 2 - 1);
+                run &= ((uint64_t)1 << lim) - 1;
+                if (!run) {
+                    break;      /* the fragment goes past the window */
+                }
+                n = 63 - __builtin_clzll(run);
+                if (wr != rd1 + pos + 1) {
+                    memmove(wr, rd1 + pos + 1, n - pos);
+                }
+                wr += n - pos;
+                pos = n;
+            }
+            if (pos) {
+                rd1 += pos;
+                continue;
+            }
+        }
+#endif
+        rd1 = simplify_fragment(path, &wr, rd1, end);
+    }
+
+    n = wr - path;
+    if (n > 1 && path[n - 1] == '/') {  /* remove the trailing path separator */
+        n--;
+    }
+    return n;
+}
 
 /* reduce a POSIX absolute path, write in place. input must be a
    valid nul terminated string. Must begin with with root
    directory */
-char* simplify_path(char* wr)
+SIMPLIFY_PATH_API char* simplify_path(char* wr)
 {
-    char* root = wr;
-    const char* rd1 = wr;
-    const char* rd2;
+    size_t n = simplify_path_len(wr, strlen(wr));
 
-    if (*root != '/') {
+    if (n == 0) {
         return NULL;   /* exception */
     }
+    if (wr[n]) {
+        wr[n] = '\0';
+    }
+    return wr;
+}
 
-    ++wr;
+struct simplify_join {
+    char* dest;
+    size_t pos;         /* start of the fragments written at the end of dest */
+    size_t required;
+    size_t skip;        /* ".." waiting for a fragment to remove */
+};
 
-    while (*rd1) {
-        for (rd2 = ++rd1; *rd2 && *rd2 != '/'; rd2++); /* find end of this fragment */
+/* fragments of s[0, len) from the last, kept ones written right aligned */
+static void simplify_join_back(struct simplify_join* j, const char* s, size_t len)
+{
+    size_t e = len, b;
 
-        if (rd2 == rd1 || 0 == strncmp(".", rd1, rd2 - rd1)) {
-            /* nothing to copy */
+    while (e > 0) {
+        for (b = e; b > 0 && s[b - 1] != '/'; b--);     /* fragment [b, e) */
+        if (e == b || (e - b == 1 && s[b] == '.')) {
+            /* nothing to keep */
         }
-        else if (0 == strncmp("..", rd1, rd2 - rd1)) {
-            /* reverse travel without exiting the root */
-            if ((wr-1) != root) {
-                wr -= 2;
-                while (*wr != '/') {
-                    wr--;
-                }
-                wr++;
+        else if (e - b == 2 && s[b] == '.' && s[b + 1] == '.') {
+            j->skip++;
+        }
+        else if (j->skip) {
+            j->skip--;
+        }
+        else {
+            j->required += e - b + 1;
+            if (j->pos >= e - b + 1) {
+                j->pos -= e - b;
+                memcpy(j->dest + j->pos, s + b, e - b);
+                j->dest[--j->pos] = '/';
+            }
+            else {
+                j->pos = 0;
             }
         }
+        e = (b > 0) ? b - 1 : 0;
+    }
+}
+
+/**
+ * Resolve rel against the absolute directory base and reduce the result,
+ * as simplify_path of base "/" rel would, without building the joined
+ * path. A rel beginning with '/' ignores base. Fragments are visited from
+ * the last, each ".." cancelling the next fragment kept, and the kept ones
+ * are written from the end of dest then moved to its start.
+ *
+ * @param dest     : nul terminated result when dest_len > *required,
+ *                   unspecified otherwise
+ * @param required : length of the result, without the nul
+ *
+ * @return 0, or EINVAL if neither base nor rel is absolute
+ */
+SIMPLIFY_PATH_API int simplify_path_join(const char* base, size_t base_len, const char* rel, size_t rel_len,
+                                         char* dest, size_t dest_len, size_t* required)
+{
+    struct simplify_join j = { dest, (dest_len > 0) ? dest_len - 1 : 0, 0, 0 };
+    int absolute = rel_len > 0 && rel[0] == '/';
+
+    if (!absolute && (base_len == 0 || base[0] != '/')) {
+        return EINVAL;
+    }
+    simplify_join_back(&j, rel, rel_len);
+    if (!absolute) {
+        simplify_join_back(&j, base, base_len);
+    }
+    if (j.required == 0) {  /* the root */
+        j.required = 1;
+        if (dest_len > 1) {
+            dest[--j.pos] = '/';
+        }
+    }
+    if (dest_len > j.required) {
+        memmove(dest, dest + j.pos, j.required);
+        dest[j.required] = '\0';
+    }
+    *required = j.required;
+    return 0;
+}
+
+#define SIMPLIFY_HASH_DEPTH 256     /* fragments kept, deeper paths are refused */
+
+/* fold the fragment s[0, n) into h, 8 bytes per multiply. The length
+   takes the free top byte of a short fragment, or a multiply of its own.
+   The last bytes are read as one word when the buffer goes on past them */
+static inline uint64_t simplify_hash_fragment(uint64_t h, const char* s, size_t n, const char* end)
+{
+    if (n >= 8) {
+        h = (h ^ n) * 0x9e3779b97f4a7c15ULL;
+    }
+    else {
+        h ^= (uint64_t)n << 56;
+    }
+    for (; n >= 8; s += 8, n -= 8) {
+        uint64_t w;
+
+        memcpy(&w, s, 8);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    if (n) {
+        uint64_t w = 0;
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (end - s >= 8) {
+            memcpy(&w, s, 8);
+            w &= ((uint64_t)1 << (8 * n)) - 1;
+        }
+        else
+#endif
+        memcpy(&w, s, n);
+        h = (h ^ w) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    return h;
+}
+
+/**
+ * Hash of path[0, len) reduced as simplify_path would, without writing
+ * the reduced path. The state after each kept fragment is pushed, ".."
+ * pops one, so every path with the same canonical form gets the same
+ * hash. The hash depends on the byte order of the host.
+ *
+ * @param hash : 64-bit hash of the canonical path
+ *
+ * @return 0, EINVAL if the path is not absolute, EOVERFLOW if more than
+ *         SIMPLIFY_HASH_DEPTH fragments are kept at once
+ */
+SIMPLIFY_PATH_API int simplify_path_hash(const char* path, size_t len, uint64_t* hash)
+{
+    uint64_t stack[SIMPLIFY_HASH_DEPTH + 1];
+    const char* end = path + len;
+    const char* p = path;
+    size_t top = 0;
+    uint64_t h;
+
+    if (len == 0 || *path != '/') {
+        return EINVAL;
+    }
+    stack[0] = 0x2f2f2f2f2f2f2f2fULL;
+    while (p < end) {
+        const char* q;
+        size_t n;
+
+        p++;
+        q = (const char*)memchr(p, '/', end - p);
+        q = q ? q : end;
+        n = q - p;
+        if (n == 0 || (n == 1 && p[0] == '.')) {
+            /* nothing */
+        }
+        else if (n == 2 && p[0] == '.' && p[1] == '.') {
+            top -= (top > 0);
+        }
+        else if (top == SIMPLIFY_HASH_DEPTH) {
+            return EOVERFLOW;
+        }
         else {
-            /* write the fragment */
-            while (*rd1 && rd1 <= rd2) {*wr++ = *rd1++;}
+            stack[top + 1] = simplify_hash_fragment(stack[top], p, n, end);
+            top++;
         }
-        rd1 = rd2;
+        p = q;
     }
+    h = stack[top] ^ top;   /* fmix64 */
+    h = (h ^ (h >> 33)) * 0xff51afd7ed558ccdULL;
+    h = (h ^ (h >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    *hash = h ^ (h >> 33);
+    return 0;
+}
+
+#define SIMPLIFY_ITER_DEPTH 256     /* fragments kept, deeper paths are refused */
+
+struct simplify_iter {
+    const char* path;
+    size_t count;                   /* fragments of the canonical path */
+    size_t pos;                     /* next one to yield */
+    struct {
+        uint32_t off, len;
+    } frag[SIMPLIFY_ITER_DEPTH];    /* slices of path */
+};
 
-    if (*wr) {
-        *wr = '\0';
+/**
+ * Fragments of path[0, len) reduced as simplify_path would, as slices of
+ * path. The path is scanned once, kept fragments are pushed as (offset,
+ * length) and ".." pops one, nothing is written. The path must outlive
+ * the iterator.
+ *
+ * @return 0, EINVAL if the path is not absolute, EOVERFLOW if more than
+ *         SIMPLIFY_ITER_DEPTH fragments are kept at once or the path is
+ *         4GB or more
+ */
+SIMPLIFY_PATH_API int simplify_iter_init(struct simplify_iter* it, const char* path, size_t len)
+{
+    const char* end = path + len;
+    const char* p = path;
+
+    it->path = path;
+    it->count = it->pos = 0;
+    if (len == 0 || *path != '/') {
+        return EINVAL;
+    }
+    if (len > UINT32_MAX) {
+        return EOVERFLOW;
     }
+    while (p < end) {
+        const char* q;
+        size_t n;
 
-    if (root != --wr && *wr == '/') {  /* remove the trailing path separator */
-        *wr = '\0';
+        p++;
+        q = (const char*)memchr(p, '/', end - p);
+        q = q ? q : end;
+        n = q - p;
+        if (n == 0 || (n == 1 && p[0] == '.')) {
+            /* nothing */
+        }
+        else if (n == 2 && p[0] == '.' && p[1] == '.') {
+            it->count -= (it->count > 0);
+        }
+        else if (it->count == SIMPLIFY_ITER_DEPTH) {
+            it->count = 0;
+            return EOVERFLOW;
+        }
+        else {
+            it->frag[it->count].off = (uint32_t)(p - path);
+            it->frag[it->count++].len = (uint32_t)n;
+        }
+        p = q;
     }
+    return 0;
+}
 
-    return root;
+/**
+ * Next fragment of the canonical path, none for the root.
+ *
+ * @return 1 with the fragment in *frag and *len, 0 past the last one
+ */
+SIMPLIFY_PATH_API int simplify_iter_next(struct simplify_iter* it, const char** frag, size_t* len)
+{
+    if (it->pos == it->count) {
+        return 0;
+    }
+    *frag = it->path + it->frag[it->pos].off;
+    *len = it->frag[it->pos++].len;
+    return 1;
 }
 
+#ifndef SIMPLIFY_PATH_LIB     /* defined by the files including this one */
+#include <stdlib.h>
 #define NELEMS(x)  (sizeof(x) / sizeof((x)[0]))
+
+/* reference reduction through a stack of fragments */
+static size_t simplify_path_stack(const char* p, size_t len, char* out)
+{
+    const char* frag[256];
+    size_t flen[256], top = 0, n = 0;
+
+    for (size_t i = 1, j; i <= len; i = j + 1) {
+        for (j = i; j < len && p[j] != '/'; j++);
+        if (j - i == 2 && p[i] == '.' && p[i + 1] == '.') {
+            top -= (top > 0);
+        }
+        else if (j > i && !(j - i == 1 && p[i] == '.')) {
+            frag[top] = p + i;
+            flen[top++] = j - i;
+        }
+    }
+    for (size_t k = 0; k < top; k++) {
+        out[n++] = '/';
+        memcpy(out + n, frag[k], flen[k]);
+        n += flen[k];
+    }
+    if (n == 0) {
+        out[n++] = '/';
+    }
+    return n;
+}
+
+static size_t random_path(char* p, size_t size, int dirty)
+{
+    static const char* const frag[] = { "usr", "lib", "x86_64-linux-gnu", "a", ".hidden", "...", "file.txt",
+                                        ".", "..", "", "." };
+    size_t n = 0;
+
+    while (n + 20 < size) {
+        const char* f = frag[rand() % (dirty ? NELEMS(frag) : 7)];
+
+        p[n++] = '/';
+        memcpy(p + n, f, strlen(f));
+        n += strlen(f);
+    }
+    return n ? n : (p[0] = '/', 1);
+}
+
+#ifdef BUILD_BENCH
+/*
+ *     gcc -O2 -mavx2 -DBUILD_BENCH simplify_path.c -o simplify_path_bench && ./simplify_path_bench
+ */
+#include <time.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main()
+{
+    enum { PATHS = 1 << 12, SIZE = 160 };
+    static char in[PATHS][SIZE], wr[PATHS][SIZE], ref[SIZE];
+    static size_t len[PATHS];
+    int fail = 0;
+
+    for (int dirty = 0; dirty < 2; dirty++) {
+        size_t bytes = 0, n = 0;
+        double t0, t1, t2;
+
+        for (int i = 0; i < PATHS; i++) {
+            len[i] = random_path(in[i], SIZE, dirty);
+            bytes += len[i];
+        }
+        t0 = now();
+        for (int r = 0; r < 256; r++) {
+            for (int i = 0; i < PATHS; i++) {
+                memcpy(wr[i], in[i], len[i]);
+                n += simplify_path_len(wr[i], len[i]);
+            }
+        }
+        t1 = now();
+        for (int r = 0; r < 256; r++) {
+            for (int i = 0; i < PATHS; i++) {
+                n -= simplify_path_stack(in[i], len[i], ref);
+            }
+        }
+        t2 = now();
+        printf("%s paths : %.1fM paths/s, %.2fGB/s, stack reference %.1fM paths/s%s\n", dirty ? "dirty" : "clean",
+               256 * PATHS / (t1 - t0) / 1e6, 256 * bytes / (t1 - t0) / 1e9, 256 * PATHS / (t2 - t1) / 1e6,
+               n ? " MISMATCH" : "");
+        fail |= n != 0;
+
+        {   /* hashing the raw path, or a reduced copy */
+            uint64_t h = 0, r = 0, x;
+
+            t0 = now();
+            for (int k = 0; k < 256; k++) {
+                for (int i = 0; i < PATHS; i++) {
+                    simplify_path_hash(in[i], len[i], &x);
+                    h += x;
+                }
+            }
+            t1 = now();
+            for (int k = 0; k < 256; k++) {
+                for (int i = 0; i < PATHS; i++) {
+                    memcpy(wr[i], in[i], len[i]);
+                    simplify_path_hash(wr[i], simplify_path_len(wr[i], len[i]), &x);
+                    r += x;
+                }
+            }
+            t2 = now();
+            printf("%s hash : %.1fM paths/s, reduce then hash %.1fM paths/s%s\n", dirty ? "dirty" : "clean",
+                   256 * PATHS / (t1 - t0) / 1e6, 256 * PATHS / (t2 - t1) / 1e6, h != r ? " MISMATCH" : "");
+            fail |= h != r;
+        }
+
+        {   /* walking the fragments, or splitting a reduced copy */
+            static struct simplify_iter it;
+            const char* f;
+            size_t a = 0, b = 0, k;
+
+            t0 = now();
+            for (int r = 0; r < 256; r++) {
+                for (int i = 0; i < PATHS; i++) {
+                    simplify_iter_init(&it, in[i], len[i]);
+                    while (simplify_iter_next(&it, &f, &k)) {
+                        a += k + (uint8_t)f[0];
+                    }
+                }
+            }
+            t1 = now();
+            for (int r = 0; r < 256; r++) {
+                for (int i = 0; i < PATHS; i++) {
+                    const char* e;
+
+                    memcpy(wr[i], in[i], len[i]);
+                    e = wr[i] + simplify_path_len(wr[i], len[i]);
+                    for (f = wr[i] + 1; f < e; f += k + 1) {
+                        const char* q = memchr(f, '/', e - f);
+
+                        k = (q ? q : e) - f;
+                        b += k + (uint8_t)f[0];
+                    }
+                }
+            }
+            t2 = now();
+            printf("%s iterator : %.1fM paths/s, reduce then split %.1fM paths/s%s\n", dirty ? "dirty" : "clean",
+                   256 * PATHS / (t1 - t0) / 1e6, 256 * PATHS / (t2 - t1) / 1e6, a != b ? " MISMATCH" : "");
+            fail |= a != b;
+        }
+    }
+    return fail;
+}
+#else
+static int hash_cmp(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
 int main()
 {
     struct {
@@ -73,4 +650,131 @@ int main()
     for (int i = 0; i < NELEMS(t); i++) {
         printf("%s\n", 0 == strcmp(t[i].result, simplify_path(t[i].input)) ? "PASS" : "FAIL");
     }
+
+    {   /* a slice of a larger buffer, the bytes past it stay as they are */
+        char buf[] = "/a/./b/../c//|/x/..";
+        size_t n = simplify_path_len(buf, 13);
+
+        printf("%s slice\n", n == 4 && 0 == memcmp(buf, "/a/c", 4) && 0 == strcmp(buf + 13, "|/x/..") ? "PASS" : "FAIL");
+        printf("%s canonical\n", is_canonical_path("/", 1) && is_canonical_path("/a/.b/...", 9) && !is_canonical_path("/a/", 3)
+               && !is_canonical_path("/a/.", 4) && !is_canonical_path("/a/..", 5) && !is_canonical_path("a", 1)
+               && !is_canonical_path("", 0) && !is_canonical_path("//", 2) ? "PASS" : "FAIL");
+        printf("%s relative\n", simplify_path_len(buf + 1, 3) == 0 && simplify_path_len(buf, 0) == 0 ? "PASS" : "FAIL");
+    }
+
+    {   /* long paths against the stack reference */
+        static char p[600], ref[600];
+        int fail = 0;
+
+        for (int i = 0; i < 100000 && !fail; i++) {
+            size_t len = random_path(p, 21 + rand() % (sizeof(p) - 21), i % 4), n, r;
+
+            if (i % 2) {   /* and a trailing separator */
+                p[len++] = '/';
+            }
+            r = simplify_path_stack(p, len, ref);
+            fail |= is_canonical_path(p, len) != (r == len && 0 == memcmp(p, ref, r));
+            n = simplify_path_len(p, len);
+            fail |= n != r || memcmp(p, ref, n);
+        }
+        printf("%s random\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* joins against simplify_path of the concatenation */
+        static const char* const base[] = { "/", "/usr/lib", "/a/b/", "/a//./b/..", "" };
+        static const char* const rel[] = { "", "foo.txt", "../..", "./x/../y/", "../../../../etc", "/abs/./p",
+                                           "..", "a/b/c/../../d", "...", "." };
+        int fail = 0;
+
+        for (int i = 0; i < NELEMS(base); i++) {
+            for (int k = 0; k < NELEMS(rel); k++) {
+                char cat[64], dest[64];
+                size_t required, n;
+                int err = simplify_path_join(base[i], strlen(base[i]), rel[k], strlen(rel[k]), dest, sizeof(dest), &required);
+
+                if (rel[k][0] == '/') {
+                    strcpy(cat, rel[k]);
+                }
+                else if (base[i][0] != '/') {
+                    fail |= err != EINVAL;
+                    continue;
+                }
+                else {
+                    snprintf(cat, sizeof(cat), "%s/%s", base[i], rel[k]);
+                }
+                simplify_path(cat);
+                n = strlen(cat);
+                fail |= err || required != n || strcmp(dest, cat);
+                /* exact size, and one byte short */
+                fail |= simplify_path_join(base[i], strlen(base[i]), rel[k], strlen(rel[k]), dest, n + 1, &required)
+                        || strcmp(dest, cat);
+                memset(dest, '#', sizeof(dest));
+                fail |= simplify_path_join(base[i], strlen(base[i]), rel[k], strlen(rel[k]), dest, n, &required)
+                        || required != n || dest[n] != '#';
+            }
+        }
+        printf("%s join\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* hashes of raw paths against those of the reduced ones, distinct paths apart */
+        static char p[600], ref[600];
+        static uint64_t seen[1 << 16];
+        uint64_t h, r;
+        int fail = 0, n = 0;
+
+        for (int i = 0; i < 100000 && !fail; i++) {
+            size_t len = random_path(p, 21 + rand() % (sizeof(p) - 21), i % 4);
+
+            fail |= simplify_path_hash(p, len, &h) || simplify_path_hash(ref, simplify_path_stack(p, len, ref), &r) || h != r;
+        }
+        for (int i = 0; i < NELEMS(seen); i++) {
+            size_t len = snprintf(p, sizeof(p), "/usr/lib/x%d/%d", i >> 8, i & 0xff);
+
+            simplify_path_hash(p, len, &seen[n++]);
+        }
+        qsort(seen, NELEMS(seen), sizeof(seen[0]), hash_cmp);
+        for (int i = 1; i < NELEMS(seen); i++) {    /* shared prefixes, no collision expected */
+            fail |= seen[i] == seen[i - 1];
+        }
+        fail |= simplify_path_hash("/ab", 3, &h) || simplify_path_hash("/a/b", 4, &r) || h == r;
+        fail |= simplify_path_hash("/", 1, &h) || simplify_path_hash("/a/..//.", 8, &r) || h != r;
+        fail |= simplify_path_hash("a/b", 3, &h) != EINVAL;
+        for (n = 0; n < 2 * SIMPLIFY_HASH_DEPTH + 2; n += 2) {
+            memcpy(p + n, "/a", 2);
+        }
+        fail |= simplify_path_hash(p, n, &h) != EOVERFLOW;
+        memcpy(p + n - 3, "/..", 3);
+        fail |= simplify_path_hash(p, n, &h) != 0;
+        printf("%s hash\n", fail ? "FAIL" : "PASS");
+    }
+
+    {   /* fragments joined back against the stack reference */
+        static char p[600], ref[600], out[600];
+        static struct simplify_iter it;
+        const char* f;
+        size_t n, k;
+        int fail = 0;
+
+        for (int i = 0; i < 100000 && !fail; i++) {
+            size_t len = random_path(p, 21 + rand() % (sizeof(p) - 21), i % 4);
+
+            fail |= simplify_iter_init(&it, p, len) != 0;
+            for (n = 0; simplify_iter_next(&it, &f, &k); n += k) {
+                fail |= f < p || f + k > p + len;   /* slices of the input */
+                out[n++] = '/';
+                memcpy(out + n, f, k);
+            }
+            n = n ? n : (out[0] = '/', 1);
+            fail |= n != simplify_path_stack(p, len, ref) || memcmp(out, ref, n);
+        }
+        fail |= simplify_iter_init(&it, "/..//.", 6) || it.count != 0 || simplify_iter_next(&it, &f, &k);
+        fail |= simplify_iter_init(&it, "a", 1) != EINVAL;
+        for (n = 0; n < 2 * SIMPLIFY_ITER_DEPTH + 2; n += 2) {
+            memcpy(p + n, "/a", 2);
+        }
+        fail |= simplify_iter_init(&it, p, n) != EOVERFLOW || simplify_iter_next(&it, &f, &k);
+        printf("%s iterator\n", fail ? "FAIL" : "PASS");
+    }
 }
+#endif
+#endif /* SIMPLIFY_PATH_LIB */
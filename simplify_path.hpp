@@ -0,0 +1,133 @@
+/******************************************************************************
+  @file   simplify_path.hpp
+  @brief
+
+  DESCRIPTION: header only C++ front end of the simplify_path.c iterator.
+
+  The fragments of the canonical form of a path are a forward range of
+  std::string_view into the path, nothing is copied nor written :
+
+      for (std::string_view f : simplify::components(path)) { ... }
+
+  A path that is not absolute, or keeps more than SIMPLIFY_ITER_DEPTH
+  fragments, gives an empty range and error() tells which. The range
+  holds the fragment stack, its iterators point to it.
+
+  The C functions are compiled static inline in every translation unit
+  including this header.
+
+****************************************************************************/
+#ifndef SIMPLIFY_PATH_HPP
+#define SIMPLIFY_PATH_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <string_view>
+
+#ifndef SIMPLIFY_PATH_API
+#define SIMPLIFY_PATH_API static inline
+#endif
+#define SIMPLIFY_PATH_LIB
+#include "simplify_path.c"
+
+namespace simplify {
+
+class components {
+public:
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const std::string_view*;
+        using reference = std::string_view;
+
+        iterator() = default;
+        iterator(const struct simplify_iter* it, size_t pos) : it_(it), pos_(pos) {}
+
+        std::string_view operator*() const
+        {
+            return std::string_view(it_->path + it_->frag[pos_].off, it_->frag[pos_].len);
+        }
+        iterator& operator++() { pos_++; return *this; }
+        iterator operator++(int) { iterator t = *this; ++*this; return t; }
+        bool operator==(const iterator& o) const { return pos_ == o.pos_; }
+        bool operator!=(const iterator& o) const { return !(*this == o); }
+
+    private:
+        const struct simplify_iter* it_ = nullptr;
+        size_t pos_ = 0;
+    };
+
+    explicit components(std::string_view path) { err_ = simplify_iter_init(&it_, path.data(), path.size()); }
+
+    components(const components&) = delete;     /* iterators point to it_ */
+    components& operator=(const components&) = delete;
+
+    iterator begin() const { return iterator(&it_, 0); }
+    iterator end() const { return iterator(&it_, it_.count); }
+    size_t size() const { return it_.count; }
+    bool empty() const { return it_.count == 0; }
+
+    /* 0, EINVAL or EOVERFLOW as simplify_iter_init */
+    int error() const { return err_; }
+
+private:
+    struct simplify_iter it_;
+    int err_;
+};
+
+} /* namespace simplify */
+
+#ifdef BUILD_TEST
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+static size_t allocations;
+
+void* operator new(std::size_t n)
+{
+    allocations++;
+    if (void* p = std::malloc(n ? n : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+int main()
+{
+    static const char* const t[] = {
+        "/", "/..", "/a//b////c/d//././/..", "/a/./b/../../c/", "/home//foo/", "/foo/.bar", "/usr/lib/../lib64/./libc.so",
+    };
+
+    for (size_t i = 0; i < sizeof(t) / sizeof(t[0]); i++) {
+        std::string p = t[i];
+        char out[64];
+        size_t n = 0, before = allocations;
+
+        for (std::string_view f : simplify::components(p)) {
+            n += snprintf(out + n, sizeof(out) - n, "/%.*s", (int)f.size(), f.data());
+        }
+        if (n == 0) {
+            n = snprintf(out, sizeof(out), "/");
+        }
+        simplify_path(&p[0]);
+        printf("%s %s : %s\n", p.c_str() == std::string_view(out) && allocations == before ? "PASS" : "FAIL", t[i], out);
+    }
+
+    {
+        simplify::components rel("a/b"), root("/./");
+
+        printf("%s errors\n", rel.error() == EINVAL && rel.empty() && root.error() == 0 && root.begin() == root.end()
+               ? "PASS" : "FAIL");
+    }
+    return 0;
+}
+#endif
+
+#endif /* SIMPLIFY_PATH_HPP */